@@ -0,0 +1,162 @@
+/*
+
+   acct.c
+
+   Every reaped stage (and every builtin stage run by the shell) is
+   added to the session totals and to a per-command table, so stats
+   can show which commands the time went to.
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "acct.h"
+#include "launch.h"
+
+typedef struct _cmdstats {
+    char *name;
+    unsigned long runs;
+    double wall, user, sys;
+    long maxrss; /* KiB */
+    long nvcsw, nivcsw;
+} CmdStats;
+
+/* --- session totals --- */
+static unsigned long pipelines;
+static CmdStats total = { "total" };
+static CmdStats *cmdstats;
+static int ncmds, cmdcap;
+static pthread_mutex_t statslock = PTHREAD_MUTEX_INITIALIZER; // Builtin threads
+
+static double tvsec(struct timeval tv)
+{
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static double tsdiff(struct timespec end, struct timespec start)
+{
+  return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/* --- acct_sub: a -= b for the counters a builtin stage is charged --- */
+void acct_sub(struct rusage *a, const struct rusage *b)
+{
+  timersub(&a->ru_utime, &b->ru_utime, &a->ru_utime);
+  timersub(&a->ru_stime, &b->ru_stime, &a->ru_stime);
+  a->ru_nvcsw -= b->ru_nvcsw;
+  a->ru_nivcsw -= b->ru_nivcsw;
+}
+
+static void addstage(CmdStats *c, JobStage *st)
+{
+  c->runs++;
+  c->wall += tsdiff(st->end, st->start);
+  c->user += tvsec(st->ru.ru_utime);
+  c->sys += tvsec(st->ru.ru_stime);
+  if (st->ru.ru_maxrss > c->maxrss)
+    c->maxrss = st->ru.ru_maxrss;
+  c->nvcsw += st->ru.ru_nvcsw;
+  c->nivcsw += st->ru.ru_nivcsw;
+}
+
+void acct_pipeline(void)
+{
+  pipelines++;
+}
+
+/* --- acct_stage: add a finished stage to the session totals --- */
+void acct_stage(JobStage *st)
+{
+  char *name = st->name ? st->name : "?";
+  int i;
+
+  pthread_mutex_lock(&statslock);
+  addstage(&total, st);
+  for (i = 0; i < ncmds; i++)
+    if (strcmp(cmdstats[i].name, name) == 0)
+      break;
+  if (i == ncmds) {
+    if (ncmds == cmdcap) {
+      cmdcap = cmdcap ? cmdcap * 2 : 32;
+      cmdstats = realloc(cmdstats, cmdcap * sizeof(CmdStats));
+    }
+    memset(&cmdstats[i], 0, sizeof(CmdStats));
+    cmdstats[i].name = strdup(name);
+    ncmds++;
+  }
+  addstage(&cmdstats[i], st);
+  pthread_mutex_unlock(&statslock);
+}
+
+/* --- one line of a report --- */
+static int printstats(int fd, CmdStats *c, char *label)
+{
+  return dprintf(fd, "%10.3fs %9.3fs %9.3fs %8ldK %8ld %8ld  %s\n",
+                 c->wall, c->user, c->sys, c->maxrss, c->nvcsw, c->nivcsw,
+                 label ? label : c->name) < 0;
+}
+
+static int printheader(int fd)
+{
+  return dprintf(fd, "%11s %10s %10s %9s %8s %8s  %s\n",
+                 "wall", "user", "sys", "maxrss", "vcsw", "ivcsw", "command") < 0;
+}
+
+/*
+ * acct_time : report on a finished job, one line per stage and one for
+ * the whole pipeline. Its wall time runs from the first start to the
+ * last exit; the other columns are sums (maxrss: the largest).
+ */
+int acct_time(Job *j, int fd)
+{
+  CmdStats all = { "total" };
+  struct timespec first = { 0 }, last = { 0 };
+  int i;
+
+  printheader(fd);
+  for (i = 0; i < j->nstages; i++) {
+    JobStage *st = &j->stages[i];
+    CmdStats one = { st->name ? st->name : "?" };
+    if (st->pid == -1) // Never started
+      continue;
+    addstage(&one, st);
+    addstage(&all, st);
+    if (first.tv_sec == 0 || tsdiff(st->start, first) < 0)
+      first = st->start;
+    if (tsdiff(st->end, last) > 0)
+      last = st->end;
+    printstats(fd, &one, NULL);
+  }
+  all.wall = tsdiff(last, first);
+  return printstats(fd, &all, "total");
+}
+
+static int bywall(const void *a, const void *b)
+{
+  double d = ((CmdStats *) b)->wall - ((CmdStats *) a)->wall;
+  return (d > 0) - (d < 0);
+}
+
+/* --- acct_stats: session totals, slowest commands first --- */
+int acct_stats(int fd)
+{
+  int i;
+
+  dprintf(fd, "%lu pipelines, %lu stages\n", pipelines, total.runs);
+  printheader(fd);
+  qsort(cmdstats, ncmds, sizeof(CmdStats), bywall);
+  for (i = 0; i < ncmds; i++) {
+    char label[64];
+    snprintf(label, sizeof(label), "%s (%lu)", cmdstats[i].name, cmdstats[i].runs);
+    printstats(fd, &cmdstats[i], label);
+  }
+  if (printstats(fd, &total, "total"))
+    return 1;
+  return spawn_report(fd);
+}
@@ -0,0 +1,22 @@
+/*
+
+   acct.h
+
+   Resource accounting for pipeline stages: the time builtin and the
+   session totals shown by stats.
+
+ */
+
+#ifndef _ACCT_H
+#define _ACCT_H
+
+#include <sys/resource.h>
+#include "jobs.h"
+
+void acct_pipeline(void);
+void acct_stage(JobStage *);
+void acct_sub(struct rusage *, const struct rusage *);
+int acct_time(Job *, int);
+int acct_stats(int);
+
+#endif
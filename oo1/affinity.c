@@ -0,0 +1,225 @@
+/*
+
+   affinity.c
+
+   A stage prefixed with @cpu=LIST (e.g. @cpu=2-3 or @cpu=0,4) may only
+   run on those CPUs; one prefixed with @nice=N runs at nice value N.
+   With set -o affinity, every stage without @cpu= is pinned to a CPU
+   of its own, adjacent stages on neighbouring CPUs of one package, so
+   the data in a pipe stays in a cache that writer and reader share.
+   Successive pipelines take the next CPUs along, round robin.
+
+   Processes get their placement before exec where the launch path
+   allows it: the fork path and the fork server apply it in the child.
+   posix_spawn inherits the CPU mask of the shell's thread, which
+   holds the stage's mask only around the spawn; its nice value is set
+   right after, since the shell could not take a raised one back.
+
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "affinity.h"
+
+/* --- symbolic constants --- */
+#define CPUPREFIX  "@cpu="
+#define NICEPREFIX "@nice="
+#define PACKAGEFILE "/sys/devices/system/cpu/cpu%d/topology/physical_package_id"
+
+int affinity_auto = 0;
+
+/* --- the CPUs the shell may use, by package, then by number --- */
+static int ncpus = -1;
+static int cpus[CPU_SETSIZE];
+static int packages[CPU_SETSIZE];
+static cpu_set_t allowed;
+static int nextcpu = 0;
+
+static int package(int cpu)
+{
+  char name[sizeof(PACKAGEFILE) + 16];
+  FILE *f;
+  int id = 0;
+
+  snprintf(name, sizeof(name), PACKAGEFILE, cpu);
+  if ((f = fopen(name, "re")) != NULL) {
+    if (fscanf(f, "%d", &id) != 1)
+      id = 0;
+    fclose(f);
+  }
+  return id;
+}
+
+static void loadcpus(void)
+{
+  int c, i, j, p;
+
+  ncpus = 0;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+    CPU_ZERO(&allowed);
+    return;
+  }
+  for (c = 0; c < CPU_SETSIZE; c++) {
+    if (!CPU_ISSET(c, &allowed))
+      continue;
+    // Insertion sort, stable: CPU numbers stay ascending per package
+    p = package(c);
+    for (i = ncpus; i > 0 && packages[i-1] > p; i--)
+      ;
+    for (j = ncpus++; j > i; j--) {
+      cpus[j] = cpus[j-1];
+      packages[j] = packages[j-1];
+    }
+    cpus[i] = c;
+    packages[i] = p;
+  }
+}
+
+/* --- "2-3,5" into set; -1 if malformed or none of them usable --- */
+static int cpulist(char *s, cpu_set_t *set)
+{
+  char *end;
+  long lo, hi;
+
+  if (ncpus < 0)
+    loadcpus();
+  CPU_ZERO(set);
+  do {
+    lo = hi = strtol(s, &end, 10);
+    if (end == s || lo < 0)
+      return -1;
+    if (*end == '-') {
+      s = end + 1;
+      hi = strtol(s, &end, 10);
+      if (end == s || hi < lo)
+        return -1;
+    }
+    if (hi >= CPU_SETSIZE)
+      return -1;
+    for (; lo <= hi; lo++)
+      CPU_SET(lo, set);
+    s = end + 1;
+  } while (*end == ',');
+  if (*end != '\0')
+    return -1;
+
+  cpu_set_t usable;
+  CPU_AND(&usable, set, &allowed);
+  return CPU_COUNT(&usable) > 0 ? 0 : -1;
+}
+
+/*
+ * affinity_prefix : take word into s if it is @cpu=LIST or @nice=N.
+ * Returns 1 if it was, 0 if word is something else, -1 (after saying
+ * why) if it was malformed.
+ */
+int affinity_prefix(char *word, StageSched *s)
+{
+  char *value, *end;
+  long n;
+
+  if (strncmp(word, CPUPREFIX, strlen(CPUPREFIX)) == 0) {
+    if (cpulist(word + strlen(CPUPREFIX), &s->cpus) < 0) {
+      fprintf(stderr, "%s: bad or unavailable CPU list\n", word);
+      return -1;
+    }
+    s->pin = 1;
+    return 1;
+  }
+  if (strncmp(word, NICEPREFIX, strlen(NICEPREFIX)) == 0) {
+    value = word + strlen(NICEPREFIX);
+    n = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || n < -20 || n > 19) {
+      fprintf(stderr, "%s: nice value must be -20..19\n", word);
+      return -1;
+    }
+    s->renice = 1;
+    s->nice = n;
+    return 1;
+  }
+  return 0;
+}
+
+/*
+ * affinity_place : with set -o affinity, pin each of the n adjacent
+ * stages in s that has no @cpu= to a CPU of its own, neighbours on
+ * neighbouring CPUs. The run stays within one package if it fits.
+ */
+void affinity_place(StageSched *s, int n)
+{
+  int i, k, want = 0, start, end;
+
+  if (!affinity_auto)
+    return;
+  if (ncpus < 0)
+    loadcpus();
+  if (ncpus < 2)
+    return; // Nowhere else to go
+
+  for (i = 0; i < n; i++)
+    want += !s[i].pin;
+  k = nextcpu % ncpus;
+  for (start = k; start > 0 && packages[start-1] == packages[k]; start--)
+    ;
+  for (end = k; end < ncpus && packages[end] == packages[k]; end++)
+    ;
+  if (k + want > end && end - start >= want) // Straddles two packages
+    k = end % ncpus;
+
+  for (i = 0; i < n; i++) {
+    if (s[i].pin)
+      continue;
+    CPU_ZERO(&s[i].cpus);
+    CPU_SET(cpus[k], &s[i].cpus);
+    s[i].pin = 1;
+    k = (k + 1) % ncpus;
+  }
+  nextcpu = k;
+}
+
+/*
+ * affinity_apply : give process pid (0: the calling thread) its CPUs
+ * and nice value. Failures are reported for name; returns 0 or the
+ * errno of the last one.
+ */
+int affinity_apply(pid_t pid, StageSched *s, char *name)
+{
+  int err = 0;
+
+  if (s->pin && sched_setaffinity(pid, sizeof(s->cpus), &s->cpus) < 0) {
+    err = errno;
+    fprintf(stderr, "%s: cpu affinity: %s\n", name, strerror(err));
+  }
+  if (s->renice && setpriority(PRIO_PROCESS, pid, s->nice) < 0) {
+    err = errno;
+    fprintf(stderr, "%s: nice: %s\n", name, strerror(err));
+  }
+  return err;
+}
+
+/*
+ * affinity_enter : run the calling thread on s's CPUs, so that a child
+ * it starts inherits them; the old mask goes to saved. Returns 1 if
+ * affinity_leave must restore it.
+ */
+int affinity_enter(StageSched *s, cpu_set_t *saved, char *name)
+{
+  if (!s->pin || sched_getaffinity(0, sizeof(*saved), saved) < 0)
+    return 0;
+  if (sched_setaffinity(0, sizeof(s->cpus), &s->cpus) < 0) {
+    fprintf(stderr, "%s: cpu affinity: %s\n", name, strerror(errno));
+    return 0;
+  }
+  return 1;
+}
+
+void affinity_leave(cpu_set_t *saved)
+{
+  sched_setaffinity(0, sizeof(*saved), saved);
+}
@@ -0,0 +1,34 @@
+/*
+
+   affinity.h
+
+   Where and how nicely pipeline stages run: @cpu= and @nice= prefixes,
+   and neighbouring CPUs for adjacent stages under set -o affinity.
+   Include after defining _GNU_SOURCE (cpu_set_t).
+
+ */
+
+#ifndef _AFFINITY_H
+#define _AFFINITY_H
+
+#include <sched.h>
+#include <sys/types.h>
+
+typedef struct _stagesched {
+    int pin;        /* run on cpus only */
+    int renice;     /* run at nice */
+    int nice;
+    cpu_set_t cpus;
+} StageSched;
+
+#define affinity_any(s) ((s) != NULL && ((s)->pin || (s)->renice))
+
+extern int affinity_auto; /* set -o affinity */
+
+int affinity_prefix(char *, StageSched *);
+void affinity_place(StageSched *, int);
+int affinity_apply(pid_t, StageSched *, char *);
+int affinity_enter(StageSched *, cpu_set_t *, char *);
+void affinity_leave(cpu_set_t *);
+
+#endif
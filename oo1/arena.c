@@ -0,0 +1,88 @@
+/*
+
+   arena.c
+
+   Chunks are kept across arena_reset, so a shell that keeps parsing
+   lines of similar size stops calling malloc after the first few.
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+/* --- symbolic constants --- */
+#define CHUNKMIN 4096
+#define ALIGN    (sizeof(void *) > sizeof(double) ? sizeof(void *) : sizeof(double))
+
+static Chunk *chunk_new(size_t need, size_t prev)
+{
+  size_t size = prev * 2;
+  if (size < CHUNKMIN)
+    size = CHUNKMIN;
+  if (size < need)
+    size = need;
+
+  Chunk *c = malloc(sizeof(Chunk) + size);
+  if (c == NULL) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(1);
+  }
+  c->next = NULL;
+  c->size = size;
+  c->used = 0;
+  return c;
+}
+
+/* --- arena_alloc: return n bytes aligned for any pointer or number --- */
+void *arena_alloc(Arena *a, size_t n)
+{
+  Chunk *c = a->cur;
+  n = (n + ALIGN - 1) & ~(ALIGN - 1);
+
+  if (c == NULL) {
+    a->head = a->cur = c = chunk_new(n, 0);
+  }
+  // Chunks after cur are left over from before the last reset
+  while (c->size - c->used < n) {
+    if (c->next == NULL)
+      c->next = chunk_new(n, c->size);
+    c = a->cur = c->next;
+    c->used = 0;
+  }
+
+  void *p = c->data + c->used;
+  c->used += n;
+  return p;
+}
+
+/* --- arena_strndup: copy n bytes of s and terminate the copy --- */
+char *arena_strndup(Arena *a, const char *s, size_t n)
+{
+  char *p = arena_alloc(a, n + 1);
+  memcpy(p, s, n);
+  p[n] = '\0';
+  return p;
+}
+
+/* --- arena_reset: make all chunks available again --- */
+void arena_reset(Arena *a)
+{
+  a->cur = a->head;
+  if (a->head != NULL)
+    a->head->used = 0;
+}
+
+/* --- arena_free: release every chunk --- */
+void arena_free(Arena *a)
+{
+  Chunk *c = a->head;
+  while (c != NULL) {
+    Chunk *next = c->next;
+    free(c);
+    c = next;
+  }
+  a->head = a->cur = NULL;
+}
@@ -0,0 +1,32 @@
+/*
+
+   arena.h
+
+   Growable bump allocator for per-line parser storage.
+
+ */
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>
+
+typedef struct _chunk {
+    struct _chunk *next;
+    size_t size;
+    size_t used;
+    char data[];
+} Chunk;
+
+/* a zeroed Arena is empty and ready for use */
+typedef struct _arena {
+    Chunk *head;
+    Chunk *cur;
+} Arena;
+
+void *arena_alloc(Arena *, size_t);         /* aligned block, never freed on its own */
+char *arena_strndup(Arena *, const char *, size_t); /* NUL terminated copy */
+void arena_reset(Arena *);                  /* O(1): forget everything, keep the chunks */
+void arena_free(Arena *);                   /* give the chunks back to malloc */
+
+#endif
@@ -0,0 +1,226 @@
+/*
+
+   bench.c
+
+   Microbenchmarks for the shell, linked against its objects:
+
+     parse       parsecommand over a corpus of command lines
+     spawn       executeshellcmd on /bin/true | ... | /bin/true, N stages
+     throughput  executeshellcmd on /bin/cat < data | ... > /dev/null
+
+   Results go to stdout as CSV, one row per measurement:
+
+     benchmark,stages,count,seconds,rate,unit
+
+   BOSH_SPAWN and BOSH_PIPESIZE are honoured as in the shell, so runs
+   with and without a change can be compared row by row.
+
+   usage: bench [-f corpus] [-i iterations] [-r reps] [-m MiB] [-n stages]
+                [parse] [spawn] [throughput]
+
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "parser.h"
+#include "execute.h"
+#include "launch.h"
+#include "pipes.h"
+
+/* --- command lines as typed at a shell prompt --- */
+static char *corpus[] = {
+  "ls -l /usr/bin",
+  "ls -la | grep -v total | sort -k 5 -n | tail -20",
+  "cat < input.txt | tr a-z A-Z | uniq -c > counts.txt",
+  "gcc -ggdb -Wall -c parser.c -o parser.o",
+  "make -j8 all",
+  "find . -name *.c | xargs grep -l malloc | wc -l &",
+  "echo hello world",
+  "sort -u < names.txt > sorted.txt",
+  "ps aux | grep bosh | grep -v grep | awk {print} | sort | uniq",
+  "tar -czf backup.tar.gz src include docs",
+  "cd /tmp",
+  "sleep 10 &",
+  "grep -rn TODO src | cut -d: -f1 | sort | uniq -c | sort -rn | head",
+  "wc -l < /etc/passwd",
+  "git log --oneline -n 20 | cat",
+  "time sha256sum big.iso",
+  NULL
+};
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void row(char *bench, int stages, long count, double secs,
+                double rate, char *unit)
+{
+  printf("%s,%d,%ld,%.6f,%.1f,%s\n", bench, stages, count, secs, rate, unit);
+  fflush(stdout);
+}
+
+/* --- the corpus from a file, one command line per line --- */
+static char **readcorpus(char *filename)
+{
+  FILE *f = fopen(filename, "re");
+  char **lines = NULL, *line = NULL;
+  size_t size = 0;
+  ssize_t len;
+  int n = 0;
+
+  if (f == NULL) {
+    perror(filename);
+    exit(EXIT_FAILURE);
+  }
+  while ((len = getline(&line, &size, f)) >= 0) {
+    if (len > 0 && line[len-1] == '\n')
+      line[--len] = '\0';
+    if (len == 0)
+      continue;
+    lines = realloc(lines, (n + 2) * sizeof(char *));
+    lines[n++] = strdup(line);
+    lines[n] = NULL;
+  }
+  free(line);
+  fclose(f);
+  return lines != NULL ? lines : corpus;
+}
+
+/* --- parse: command lines and bytes parsed per second --- */
+static void benchparse(char **lines, long iterations)
+{
+  Shellcmd cmd = { 0 };
+  long n = 0, bytes = 0, i;
+  char **l;
+  double start, secs;
+
+  for (l = lines; *l != NULL; l++)
+    bytes += strlen(*l);
+  start = now();
+  for (i = 0; i < iterations; i++)
+    for (l = lines; *l != NULL; l++)
+      if (parsecommand(*l, &cmd) > 0)
+        n++;
+  secs = now() - start;
+  freeshellcmd(&cmd);
+  row("parse", 0, n, secs, n / secs, "lines/s");
+  row("parse", 0, n, secs, bytes * iterations / secs / (1 << 20), "MiB/s");
+}
+
+/* --- a pipeline of n copies of stage, with optional redirections --- */
+static char *pipeline(char *stage, int n, char *in, char *out)
+{
+  static char line[4096];
+  char *p = line;
+  int i;
+
+  for (i = 0; i < n; i++)
+    p += sprintf(p, "%s%s", i ? " | " : "", stage);
+  if (in != NULL)
+    p += sprintf(p, " < %s", in);
+  if (out != NULL)
+    p += sprintf(p, " > %s", out);
+  return line;
+}
+
+/* --- spawn: time from start to the last exit of /bin/true pipelines --- */
+static void benchspawn(int maxstages, int reps)
+{
+  Shellcmd cmd = { 0 };
+  int n, r;
+  double start, secs;
+
+  for (n = 1; n <= maxstages; n *= 2) {
+    char *line = pipeline("/bin/true", n, NULL, NULL);
+    start = now();
+    for (r = 0; r < reps; r++)
+      if (parsecommand(line, &cmd) > 0)
+        executeshellcmd(&cmd);
+    secs = now() - start;
+    row("spawn", n, reps, secs, secs / reps * 1e6, "usec/pipeline");
+    row("spawn", n, reps, secs, secs / reps / n * 1e6, "usec/stage");
+  }
+  freeshellcmd(&cmd);
+}
+
+/* --- throughput: bytes per second through 1..maxstages /bin/cat --- */
+static void benchthroughput(int maxstages, long mib)
+{
+  Shellcmd cmd = { 0 };
+  char data[] = "/tmp/boshbenchXXXXXX";
+  char buf[1 << 16] = { 0 };
+  int fd, n;
+  long i;
+  double start, secs;
+
+  if ((fd = mkstemp(data)) < 0) {
+    perror(data);
+    return;
+  }
+  for (i = 0; i < mib * (1 << 20) / (long) sizeof(buf); i++)
+    if (write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+      perror(data);
+      break;
+    }
+  close(fd);
+
+  for (n = 1; n <= maxstages; n++) {
+    char *line = pipeline("/bin/cat", n, data, "/dev/null");
+    if (parsecommand(line, &cmd) <= 0)
+      break;
+    start = now();
+    executeshellcmd(&cmd);
+    secs = now() - start;
+    row("throughput", n, mib << 20, secs, mib / secs, "MiB/s");
+  }
+  freeshellcmd(&cmd);
+  unlink(data);
+}
+
+int main(int argc, char *argv[])
+{
+  char **lines = corpus;
+  long iterations = 20000, mib = 256;
+  int reps = 200, maxstages = 16, all, opt;
+
+  while ((opt = getopt(argc, argv, "f:i:r:m:n:")) != -1) {
+    switch (opt) {
+      case 'f': lines = readcorpus(optarg); break;
+      case 'i': iterations = atol(optarg); break;
+      case 'r': reps = atoi(optarg); break;
+      case 'm': mib = atol(optarg); break;
+      case 'n': maxstages = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-f corpus] [-i iterations] [-r reps]"
+                " [-m MiB] [-n stages] [parse] [spawn] [throughput]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  spawn_init();
+  pipe_init();
+
+  all = optind == argc;
+  printf("benchmark,stages,count,seconds,rate,unit\n");
+  for (; optind < argc || all; optind++, all = 0) {
+    char *which = all ? NULL : argv[optind];
+    if (which == NULL || strcmp(which, "parse") == 0)
+      benchparse(lines, iterations);
+    if (which == NULL || strcmp(which, "spawn") == 0)
+      benchspawn(maxstages, reps);
+    if (which == NULL || strcmp(which, "throughput") == 0)
+      benchthroughput(maxstages, mib);
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,36 @@
+#!/bin/sh
+#
+#   pipesize.sh [MiB] [sizes...]
+#
+#   Throughput of /bin/cat | /bin/cat | ... pipelines run by bosh, for
+#   1 to 8 stages, with the default pipe capacity and with pipesize=SIZE.
+#   Prints stages,pipesize,seconds,MiB/s lines.
+#
+
+BOSH=${BOSH:-$(dirname "$0")/../bosh}
+MB=${1:-256}
+[ $# -gt 0 ] && shift
+SIZES=${*:-"default 256K 1M"}
+DATA=$(mktemp /tmp/pipesize.XXXXXX)
+trap 'rm -f "$DATA"' EXIT
+
+head -c "${MB}M" /dev/zero > "$DATA"
+
+echo "stages,pipesize,seconds,MiB/s"
+for n in 1 2 4 8; do
+  cmd="/bin/cat"
+  i=1
+  while [ $i -lt $n ]; do
+    cmd="$cmd | /bin/cat"
+    i=$((i + 1))
+  done
+  for size in $SIZES; do
+    prefix=""
+    [ "$size" != default ] && prefix="pipesize=$size"
+    start=$(date +%s.%N)
+    "$BOSH" -c "$prefix $cmd < $DATA > /dev/null"
+    end=$(date +%s.%N)
+    echo "$n,$size,$start,$end,$MB" |
+      awk -F, '{ t = $4 - $3; printf "%s,%s,%.3f,%.0f\n", $1, $2, t, $5 / t }'
+  done
+done
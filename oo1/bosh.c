@@ -4,6 +4,7 @@
 
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -15,13 +16,20 @@
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include "redirect.h"
 #include "parser.h"
-#include "forback.h"
-#include "pipe.h"
-#include "print.h"
+#include "launch.h"
+#include "jobs.h"
+#include "builtin.h"
+#include "pipes.h"
+#include "execute.h"
+#include "trace.h"
+#include "plan.h"
 
 /* --- symbolic constants --- */
 #define HOSTNAMEMAX 100
@@ -32,154 +40,120 @@ void handler(int dummy)
 }
 
 /* --- use the /proc filesystem to obtain the hostname --- */
-char *gethostname(char *hostname)
+int readhostname(char *hostname)
 {
   FILE *file;
   file = fopen("/proc/sys/kernel/hostname", "r");
-  fscanf(file, "%s", hostname);
+  if (file == NULL)
+    return -1;
+  fscanf(file, "%99s", hostname);
   fclose(file);
+  return 0;
 }
 
-/* --- execute a shell command --- */
-int executeshellcmd (Shellcmd *shellcmd)
-{
-  Cmd *cmdlist = shellcmd->the_cmds;
-  int background = shellcmd->background;
-  char *infilename = shellcmd->rd_stdin;
-  char *outfilename = shellcmd->rd_stdout;
-
-  // Count amount of commands (pipe-components)
-  Cmd *cmdlistCounter = cmdlist;
-  int cmdAmount = 0;
-  while(cmdlistCounter != NULL){
-    cmdlistCounter = cmdlistCounter->next;
-    cmdAmount++;
-  }
-  printf("Command amount: %d\n", cmdAmount);
-
-  int fd[2]; // New pipe declared
+/* --- interactive state, shared with the readline callback --- */
+#define TERMINATE_EOF  1
+#define TERMINATE_EXIT 2
+static int terminate = 0;
+static char prompt[HOSTNAMEMAX + 4];
+static Shellcmd shellcmd = { 0 };
 
-  int in  = -1; // In being used at execution
-  int out  = -1; // Out to be passed on
-  int last_out; // Out to use
-  if (outfilename != NULL) {
-    last_out = open(outfilename, O_WRONLY|O_CREAT);
+/* --- called by readline for every complete line --- */
+void linehandler(char *cmdline)
+{
+  if (cmdline == NULL) { // Ctrl + D
+    terminate = TERMINATE_EOF;
+    runeof(&shellcmd);
   }
   else {
-    last_out = -1;
-  }
-
-  pid_t pids[cmdAmount];
-  int i;
-  for (i = 0; cmdlist != NULL; i++ ) {
-    char **cmd = cmdlist->cmd; // Current command
-    cmdlist = cmdlist->next; // Iteration
-
-    // Init pipe if another command exists
-    if (cmdlist != NULL) {
-      // if true: pipe was used
-      if (pipe(fd) < 0) {
-        printf("Error when creating pipe.\n");
-        return -1;
-      }
-      in = fd[0];
-      out = fd[1];
-    }
-    else {
-      // Last command (First input command - replace input if any inputfile provided)
-      if (infilename != NULL) {
-        in = open(infilename, O_RDONLY);
-      }
-      else {
-        in = -1;
-      }
-      out = -1;
+    if(*cmdline || heredocpending(&shellcmd) || plan_pending()) {
+      add_history(cmdline);
+      if (runline(cmdline, &shellcmd))
+        terminate = TERMINATE_EXIT;
     }
+    free(cmdline);
+  }
+  if (terminate) // No new prompt
+    rl_callback_handler_remove();
+  else // Lines of a << body get a continuation prompt
+    rl_set_prompt(heredocpending(&shellcmd) || plan_pending() ? "> " : prompt);
+}
 
-    printf("Before execution of %s: in: %d, out: %d, last_out: %d\n", *cmd, in, out, last_out);
+/* --- print finished background jobs without garbling the input line --- */
+void reapatprompt(void)
+{
+  int point = rl_point;
+  char *line = rl_copy_text(0, rl_end);
+
+  rl_set_prompt("");
+  rl_replace_line("", 0);
+  rl_redisplay();
+  jobs_reap();
+  fflush(stdout);
+  rl_set_prompt(heredocpending(&shellcmd) || plan_pending() ? "> " : prompt);
+  rl_replace_line(line, 0);
+  rl_point = point;
+  rl_on_new_line();
+  rl_redisplay();
+  free(line);
+}
 
-    // Execution
-    pid_t pid = fork();
-    pids[i] = pid;
-    if (pid == 0) { // child
-      if(out != -1) {
-        close(out);
-      }
-      redirect_stdinandout(in, last_out);
-      int status = execvp(*cmd, cmd); // Execute current command
-      if (status == -1) {
-        printf("Command not found.\n");
-        exit(1);
-      }
-    }
+/* --- main loop of the simple shell --- */
+int main(int argc, char* argv[]) {
 
-    if(in != -1) {
-      close(in);
-    }
-    if(last_out != -1) {
-      close(last_out);
-    }
+  /* initialize the shell */
+  char hostname[HOSTNAMEMAX];
 
-    if(cmdlist != NULL) {
-      // Update last_out for next command
-      last_out = out;
+  signal(SIGPIPE, SIG_IGN); // Builtins see EPIPE instead
+  spawn_init();
+  pipe_init();
+  trace_init();
+
+  /* batch modes: no readline, prompt or hostname */
+  if (argc > 1) {
+    if (strcmp(argv[1], "-c") == 0) {
+      if (argc < 3) {
+        fprintf(stderr, "usage: %s [-c commands | script]\n", argv[0]);
+        return EXIT_FAILURE;
+      }
+      runstring(argv[2], &shellcmd);
     }
     else {
-      // No next command: Close file if not null, just in case
-      if(out != -1) {
-        close(out);
+      FILE *script = fopen(argv[1], "re");
+      if (script == NULL) {
+        fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+        return EXIT_FAILURE;
       }
+      runscript(script, &shellcmd);
+      fclose(script);
     }
+    return shell_status;
   }
-
-  if(!background){ // Wait for all processes
-    for(i = 0; i < cmdAmount; i++){
-      waitpid(pids[i], NULL, 0);
-    }
+  if (!isatty(0)) { // Commands piped or redirected into the shell
+    runscript(stdin, &shellcmd);
+    return shell_status;
   }
 
-  return 0;
-}
-
-/* --- main loop of the simple shell --- */
-int main(int argc, char* argv[]) {
-
-  /* initialize the shell */
-  char *cmdline;
-  char hostname[HOSTNAMEMAX];
-  int terminate = 0;
-  Shellcmd shellcmd;
-
   signal(SIGINT, handler); // Listen for Ctrl + C
-  
-  if (!gethostname(hostname)) {
 
-    /* parse commands until exit or ctrl-c */
+  if (!readhostname(hostname)) {
+    snprintf(prompt, sizeof(prompt), "%s:# ", hostname);
+    jobs_verbose = 1;
+    rl_callback_handler_install(prompt, linehandler);
+
+    /* parse commands until exit or ctrl-c; report background jobs
+       as soon as they finish, even while the prompt is showing */
     while (!terminate) {
-      printf("%s", hostname);
-      if (cmdline = readline(":# ")) {
-      	if(*cmdline) {
-          if (checkIfExit(cmdline)) {
-            return EXIT_SUCCESS;
-          }
-      	  add_history(cmdline);
-      	  if (parsecommand(cmdline, &shellcmd)) {
-      	    executeshellcmd(&shellcmd);
-      	  }
-      	}
-      	free(cmdline);
-      } else terminate = 1;
+      struct pollfd pfd[2] = { { 0, POLLIN, 0 }, { jobs_pollfd(), POLLIN, 0 } };
+      if (poll(pfd, 2, -1) < 0)
+        continue;
+      if (pfd[1].revents)
+        reapatprompt();
+      if (pfd[0].revents)
+        rl_callback_read_char();
     }
-    printf("Exiting bosh.\n");
+    if (terminate == TERMINATE_EOF)
+      printf("Exiting bosh.\n");
   }
-  return EXIT_SUCCESS;
+  return shell_status;
 }
-
-int checkIfExit(char *firstCmd)
-{
-  if(strcmp(firstCmd, "exit") == 0){ // they are equal
-    return 1;
-  }
-  return 0;
-}
-
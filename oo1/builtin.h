@@ -0,0 +1,41 @@
+/*
+
+   builtin.h
+
+   Commands that run inside the shell process, without fork or exec.
+
+ */
+
+#ifndef _BUILTIN_H
+#define _BUILTIN_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* argv, stdin fd, stdout fd; returns the exit status */
+typedef int (*Builtinfn)(char **, int, int);
+
+typedef struct _builtin {
+    char *name;
+    Builtinfn fn;
+    int flags;
+} Builtin;
+
+/* --- flags --- */
+#define BUILTIN_THREAD 1 /* only touches its fds: may run on a thread of its own */
+#define BUILTIN_SPLICE 2 /* copies with zcopy: faster through a real pipe than a queue */
+
+extern int shell_terminate; /* set by exit */
+extern int shell_status;    /* status of the last command */
+extern int builtin_forked;  /* in a child of forkbuiltin: the shell's state is out of reach */
+extern int builtin_stdin;   /* fd 0 is still the shell's own stdin, not a pipe into the stage */
+
+Builtin *findbuiltin(char *);
+int runbuiltin(Builtin *, char **, int, int, char *, char *);
+pid_t forkbuiltin(Builtin *, char **, int, int, char *, char *);
+
+int bwrite(int, const void *, size_t);
+int bputs(int, const char *);
+int bclose(int);
+
+#endif
@@ -0,0 +1,279 @@
+/*
+
+   coproc.c
+
+     coproc NAME cmd [args]    start cmd once, between two pipes
+     cowrite NAME [WORD ...]   send the words as a line, else our stdin
+     coread NAME [N]           copy N lines (default 1) of its output
+     coclose NAME              close its stdin, copy the rest of its
+                               output and wait for it; its exit status
+
+   A filter with a slow start (a converter that loads tables, an
+   interpreter) is started once and then serves any number of small
+   requests without a fork, exec and init for each. The shell keeps
+   the write end of the coprocess's stdin and the read end of its
+   stdout; both are close-on-exec, so other commands never hold them
+   and coclose really delivers EOF. coread reads ahead into a buffer
+   of the coprocess and hands out whole lines, so what it did not ask
+   for is there for the next coread.
+
+   The pipes only live in the shell process: coproc, cowrite, coread
+   and coclose must be the builtin the shell runs itself, i.e. the only
+   one of a pipeline that is not run with &. Elsewhere they run in a
+   child process of their own and refuse to. A filter that buffers its output (stdio to a pipe) may
+   have to be told to flush each line for coread to see it.
+
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "coproc.h"
+#include "builtin.h"
+#include "launch.h"
+#include "jobs.h"
+#include "pipes.h"
+#include "zcopy.h"
+
+/* --- symbolic constants --- */
+#define READCHUNK 65536
+
+typedef struct _coproc {
+    struct _coproc *next;
+    char *name;
+    int to, from;       /* our ends: its stdin, its stdout; -1 once closed */
+    Job *job;
+    char *buf;          /* read from its stdout, not handed out yet */
+    size_t len, cap;
+} Coproc;
+
+static Coproc *coprocs;
+
+static Coproc *find(char *name)
+{
+  Coproc *c;
+
+  for (c = coprocs; c != NULL; c = c->next)
+    if (strcmp(c->name, name) == 0)
+      return c;
+  fprintf(stderr, "%s: no such coprocess\n", name);
+  return NULL;
+}
+
+/* --- close our ends of c's pipes, wait for it and forget it; its status --- */
+static int finish(Coproc *c)
+{
+  Coproc **p;
+  int status;
+
+  if (c->to != -1)
+    close(c->to);
+  if (c->from != -1)
+    close(c->from);
+  status = job_wait(c->job);
+  job_free(c->job);
+  for (p = &coprocs; *p != c; p = &(*p)->next)
+    ;
+  *p = c->next;
+  free(c->name);
+  free(c->buf);
+  free(c);
+  return status;
+}
+
+/*
+ * coproc_start : run argv as coprocess name. A finished coprocess of
+ * the same name is replaced; a running one is an error. Returns 0 or 1.
+ */
+int coproc_start(char *name, char **argv)
+{
+  Coproc *c;
+  int in[2], out[2];
+  pid_t pid;
+
+  for (c = coprocs; c != NULL; c = c->next)
+    if (strcmp(c->name, name) == 0)
+      break;
+  if (c != NULL) {
+    if (job_check(c->job) > 0) {
+      fprintf(stderr, "coproc: %s is running\n", name);
+      return 1;
+    }
+    finish(c);
+  }
+
+  if (mkpipe(in, pipe_size) < 0) {
+    fprintf(stderr, "coproc: %s\n", strerror(errno));
+    return 1;
+  }
+  if (mkpipe(out, pipe_size) < 0) {
+    fprintf(stderr, "coproc: %s\n", strerror(errno));
+    close(in[0]);
+    close(in[1]);
+    return 1;
+  }
+
+  if ((c = calloc(1, sizeof(Coproc))) == NULL ||
+      (c->name = strdup(name)) == NULL ||
+      (c->job = job_new(1, argv[0], 0)) == NULL) {
+    fprintf(stderr, "coproc: %s\n", strerror(ENOMEM));
+    if (c != NULL)
+      free(c->name);
+    free(c);
+    close(in[0]);
+    close(in[1]);
+    close(out[0]);
+    close(out[1]);
+    return 1;
+  }
+  job_stagestart(c->job, 0, argv[0]);
+  pid = spawncmd(argv, in[0], out[1], NULL, NULL);
+  job_setpid(c->job, 0, pid);
+  close(in[0]);
+  close(out[1]);
+  c->to = in[1];
+  c->from = out[0];
+  c->next = coprocs;
+  coprocs = c;
+  if (pid < 0) { // spawncmd has said why
+    finish(c);
+    return 1;
+  }
+  return 0;
+}
+
+/*
+ * coproc_write : send words to coprocess name as one line, or
+ * everything that can be read from in when there are none.
+ */
+int coproc_write(char *name, char **words, int in)
+{
+  Coproc *c = find(name);
+  char **w;
+
+  if (c == NULL)
+    return 1;
+  if (c->to == -1) {
+    fprintf(stderr, "cowrite: %s: stdin closed\n", name);
+    return 1;
+  }
+  if (*words == NULL) {
+    if (zcopy(in, c->to, NULL) < 0) {
+      fprintf(stderr, "cowrite: %s: %s\n", name, strerror(errno));
+      return 1;
+    }
+    return 0;
+  }
+  for (w = words; *w != NULL; w++)
+    if (bputs(c->to, *w) < 0 || bputs(c->to, w[1] != NULL ? " " : "\n") < 0) {
+      fprintf(stderr, "cowrite: %s: %s\n", name, strerror(errno));
+      return 1;
+    }
+  return 0;
+}
+
+/*
+ * fill : read more of c's output into its buffer; 0 at EOF. Waits in
+ * poll, which ^C interrupts (read would be restarted): -1 and EINTR.
+ */
+static ssize_t fill(Coproc *c)
+{
+  struct pollfd pfd = { c->from, POLLIN, 0 };
+  ssize_t n;
+
+  if (c->cap - c->len < READCHUNK) {
+    c->cap = c->len + READCHUNK * 2;
+    c->buf = realloc(c->buf, c->cap);
+  }
+  if (poll(&pfd, 1, -1) < 0)
+    return -1;
+  do
+    n = read(c->from, c->buf + c->len, c->cap - c->len);
+  while (n < 0 && errno == EINTR);
+  if (n > 0)
+    c->len += n;
+  return n;
+}
+
+/* --- hand out the first n bytes of c's buffer --- */
+static int drain(Coproc *c, size_t n, int out)
+{
+  int status = bwrite(out, c->buf, n);
+
+  memmove(c->buf, c->buf + n, c->len - n);
+  c->len -= n;
+  return status;
+}
+
+/*
+ * coproc_read : copy the next lines lines of name's output to out,
+ * waiting for them as long as it runs. Returns 0, or 1 if it ended
+ * before that many lines came. Lines that came before a ^C are kept
+ * for the next coread.
+ */
+int coproc_read(char *name, long lines, int out)
+{
+  Coproc *c = find(name);
+  size_t scanned = 0;
+  char *nl;
+  ssize_t n = 1;
+
+  if (c == NULL)
+    return 1;
+  while (lines > 0) {
+    if ((nl = memchr(c->buf + scanned, '\n', c->len - scanned)) != NULL) {
+      scanned = nl - c->buf + 1;
+      lines--;
+      continue;
+    }
+    scanned = c->len;
+    if ((n = fill(c)) <= 0)
+      break;
+  }
+  if (n < 0 && errno == EINTR)
+    return 128 + SIGINT;
+  if (n < 0)
+    fprintf(stderr, "coread: %s: %s\n", name, strerror(errno));
+  if (lines > 0) // Ended without a newline: the rest is the last line
+    scanned = c->len;
+  if (scanned > 0 && drain(c, scanned, out) < 0)
+    return 1;
+  return lines > 0;
+}
+
+/*
+ * coproc_close : send name EOF, copy whatever it still writes to out
+ * and wait for it to exit. Returns its exit status.
+ */
+int coproc_close(char *name, int out)
+{
+  Coproc *c = find(name);
+
+  if (c == NULL)
+    return 1;
+  if (c->to != -1)
+    close(c->to);
+  c->to = -1;
+  if (c->len > 0)
+    drain(c, c->len, out);
+  if (zcopy(c->from, out, NULL) < 0 && errno != EPIPE)
+    fprintf(stderr, "coclose: %s: %s\n", name, strerror(errno));
+  return finish(c);
+}
+
+/* --- coproc_list: coproc without arguments --- */
+int coproc_list(int out)
+{
+  Coproc *c;
+
+  for (c = coprocs; c != NULL; c = c->next)
+    dprintf(out, "%-12s %7d  %s\n", c->name, c->job->stages[0].pid,
+            job_check(c->job) > 0 ? "running" : "done");
+  return 0;
+}
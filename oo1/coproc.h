@@ -0,0 +1,19 @@
+/*
+
+   coproc.h
+
+   Named coprocesses: long-running filters that stay up between
+   command lines, fed and drained through pipes the shell holds.
+
+ */
+
+#ifndef _COPROC_H
+#define _COPROC_H
+
+int coproc_start(char *, char **);
+int coproc_write(char *, char **, int);
+int coproc_read(char *, long, int);
+int coproc_close(char *, int);
+int coproc_list(int);
+
+#endif
@@ -0,0 +1,477 @@
+/*
+
+   execute.c
+
+   Running parsed command lines: executeshellcmd starts the stages of
+   one pipeline, runline/runscript/runstring feed it lines of input.
+
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "execute.h"
+#include "launch.h"
+#include "jobs.h"
+#include "builtin.h"
+#include "pipes.h"
+#include "queue.h"
+#include "heredoc.h"
+#include "subst.h"
+#include "wildcard.h"
+#include "trace.h"
+#include "plan.h"
+#include "meter.h"
+#include "affinity.h"
+
+/* --- symbolic constants --- */
+#define SCRIPTBUFFER (1 << 20)
+#define PIPESIZEPREFIX "pipesize="
+
+/* --- a builtin stage running on a thread of its own --- */
+typedef struct _stagethread {
+    pthread_t tid;
+    Job *job;
+    int stage;
+    Builtin *b;
+    char **cmd;
+    StageSched *sched;
+    int in, out;
+    char *infilename, *outfilename;
+} StageThread;
+
+#define threadable(b) ((b) != NULL && ((b)->flags & BUILTIN_THREAD))
+#define splices(b)    ((b)->flags & BUILTIN_SPLICE)
+
+/* --- the thread owns in and out and closes them when it is done --- */
+static void *stagethread(void *arg)
+{
+  StageThread *t = arg;
+  int status;
+
+  job_stagestart(t->job, t->stage, *t->cmd);
+  if (affinity_any(t->sched))
+    affinity_apply(0, t->sched, *t->cmd);
+  status = runbuiltin(t->b, t->cmd, t->in, t->out, t->infilename, t->outfilename);
+  job_setstatus(t->job, t->stage, status);
+  if (t->in != -1)
+    bclose(t->in);
+  if (t->out != -1)
+    bclose(t->out);
+  return NULL;
+}
+
+/* --- start the stages of cmdlist, the (expanded) commands of shellcmd --- */
+static int execute(Shellcmd *shellcmd, Cmd *cmdlist, int stdoutfd)
+{
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  int background = shellcmd->background;
+  char *infilename = shellcmd->rd_stdin;
+  char *outfilename = shellcmd->rd_stdout;
+
+  // Count amount of commands (pipe-components)
+  Cmd *cmdlistCounter = cmdlist;
+  int cmdAmount = 0;
+  while(cmdlistCounter != NULL){
+    cmdlistCounter = cmdlistCounter->next;
+    cmdAmount++;
+  }
+
+  // Prefixes of the first command apply to the whole pipeline: time
+  // reports on it, pipesize=SIZE sets the capacity of its pipes. The
+  // words stay in place, so a parsed command can run again.
+  int timed = 0;
+  long pipesize = pipe_size;
+  char **first;
+  for (cmdlistCounter = cmdlist; cmdlistCounter->next != NULL; )
+    cmdlistCounter = cmdlistCounter->next;
+  for (first = cmdlistCounter->cmd; first[1] != NULL; first++) {
+    if (strcmp(*first, "time") == 0)
+      timed = 1;
+    else if (strncmp(*first, PIPESIZEPREFIX, strlen(PIPESIZEPREFIX)) == 0) {
+      if ((pipesize = pipe_parsesize(*first + strlen(PIPESIZEPREFIX))) < 0) {
+        fprintf(stderr, "%s: bad size\n", *first);
+        return 1;
+      }
+    }
+    else
+      break;
+  }
+
+  // @cpu= and @nice= in front of a stage place it; set -o affinity
+  // places the others
+  char **argvs[cmdAmount];
+  StageSched sched[cmdAmount];
+  int placed[cmdAmount];
+  int i, k;
+  for (cmdlistCounter = cmdlist, i = 0; cmdlistCounter != NULL; cmdlistCounter = cmdlistCounter->next, i++) {
+    char **cmd = cmdlistCounter->next == NULL ? first : cmdlistCounter->cmd;
+    memset(&sched[i], 0, sizeof(sched[i]));
+    while (*cmd != NULL && (k = affinity_prefix(*cmd, &sched[i])) != 0) {
+      if (k < 0)
+        return 1;
+      cmd++;
+    }
+    if (*cmd == NULL) {
+      fprintf(stderr, "%s: missing command\n", cmd[-1]);
+      return 1;
+    }
+    argvs[i] = cmd;
+    placed[i] = affinity_any(&sched[i]);
+  }
+  affinity_place(sched, cmdAmount);
+
+  // << and <<< bodies reach the first command as a sealed memfd
+  int herefd = -1;
+  if (shellcmd->rd_here != NULL &&
+      (herefd = heredoc_open(shellcmd->rd_here, shellcmd->rd_herelen)) < 0) {
+    fprintf(stderr, "here-document: %s\n", strerror(errno));
+    return 1;
+  }
+
+  // A lone builtin needs neither pipes nor a job; in the background
+  // it gets a process like any other stage
+  Builtin *b;
+  if (cmdAmount == 1 && !timed && !placed[0] && !background && (b = findbuiltin(argvs[0][0])) != NULL) {
+    int status = runbuiltin(b, argvs[0], herefd, stdoutfd, infilename, outfilename);
+    if (herefd != -1)
+      close(herefd);
+    return status;
+  }
+
+  // Runs of two or more adjacent builtins that only touch their fds
+  // become threads of the shell, joined by queues instead of pipes;
+  // data reaches the kernel only where a process sits next to them.
+  // Next to a cat they stay joined by a pipe, which its zcopy splices
+  // through without copying. Background pipelines keep one process
+  // per stage.
+  Builtin *bs[cmdAmount];
+  int fused[cmdAmount + 1];
+  int nthreads = 0;
+  for (i = 0; i < cmdAmount; i++)
+    bs[i] = findbuiltin(argvs[i][0]);
+  for (i = 0; i < cmdAmount; i++) {
+    fused[i] = !background && threadable(bs[i]) &&
+      ((i > 0 && threadable(bs[i-1])) || (i + 1 < cmdAmount && threadable(bs[i+1])));
+    nthreads += fused[i];
+  }
+  fused[cmdAmount] = 0;
+  StageThread threads[nthreads + 1];
+  nthreads = 0;
+
+  fflush(stdout); // Keep the shell's output ahead of the children's
+
+  int fd[2]; // New pipe declared
+
+  int in  = -1; // In being used at execution
+  int out  = -1; // Out to be passed on
+  int last_out = stdoutfd == -1 ? -1 : fcntl(stdoutfd, F_DUPFD_CLOEXEC, 0); // Out to use
+
+  // One builtin stage runs in the shell once every process has started;
+  // any other builtin stage gets a process, or two stages in the shell
+  // would wait for each other through a full pipe. So does one placed
+  // by its own prefixes: the shell's main thread stays where it is.
+  // In a background pipeline they all do, so the prompt comes back.
+  struct { Builtin *b; char **cmd; int in, out, stage; } inshell = { NULL };
+
+  // The list runs from the last pipe-component to the first
+  Job *job = job_new(cmdAmount, shellcmdtext(shellcmd), background);
+  job->timed = timed;
+  // set -o meter: a relay counts what goes through each pipe
+  Meter *meter = meter_on && cmdAmount > 1 ? meter_new(job->cmdline, cmdAmount - 1) : NULL;
+  int status;
+  for (i = 0; cmdlist != NULL; i++ ) {
+    char **cmd = argvs[i]; // Current command
+    cmdlist = cmdlist->next; // Iteration
+
+    // Init pipe if another command exists
+    if (cmdlist != NULL) {
+      // Close-on-exec: children only keep the ends placed on stdin/stdout
+      if ((!fused[i] || !fused[i+1] || splices(bs[i]) || splices(bs[i+1]) ||
+           queue_pipe(fd, QUEUESIZE) < 0) &&
+          (meter != NULL ? meter_pipe(meter, fd, pipesize, argvs[i+1][0], *cmd)
+                         : mkpipe(fd, pipesize)) < 0) {
+        printf("Error when creating pipe.\n");
+        if (last_out != -1)
+          bclose(last_out);
+        break;
+      }
+      in = fd[0];
+      out = fd[1];
+    }
+    else {
+      in = herefd;
+      out = -1;
+    }
+
+    b = bs[i];
+    if (fused[i]) { // The thread takes over in and last_out
+      StageThread *t = &threads[nthreads];
+      t->job = job;
+      t->stage = cmdAmount - 1 - i;
+      t->b = b;
+      t->cmd = cmd;
+      t->sched = &sched[i];
+      t->in = in;
+      t->out = last_out;
+      t->infilename = cmdlist == NULL ? infilename : NULL;
+      t->outfilename = i == 0 ? outfilename : NULL;
+      if (pthread_create(&t->tid, NULL, stagethread, t) == 0)
+        nthreads++;
+      else {
+        fprintf(stderr, "%s: cannot start a thread\n", *cmd);
+        job_stagestart(job, t->stage, *cmd);
+        job_setstatus(job, t->stage, 1);
+        if (in != -1)
+          bclose(in);
+        if (last_out != -1)
+          bclose(last_out);
+      }
+      last_out = out;
+      continue;
+    }
+    if (b != NULL && inshell.b == NULL && !placed[i] && !background) { // Keep its fds for later
+      inshell.b = b;
+      inshell.cmd = cmd;
+      inshell.in = in;
+      inshell.out = last_out;
+      inshell.stage = cmdAmount - 1 - i;
+      last_out = out;
+      continue;
+    }
+
+    // Execution: < is opened for the first command, > for the last
+    pid_t pid;
+    job_stagestart(job, cmdAmount - 1 - i, *cmd);
+    if (b != NULL) {
+      pid = forkbuiltin(b, cmd, in, last_out,
+                        cmdlist == NULL ? infilename : NULL,
+                        i == 0 ? outfilename : NULL);
+      if (pid > 0 && affinity_any(&sched[i]))
+        affinity_apply(pid, &sched[i], *cmd);
+    }
+    else
+      pid = spawnstage(cmd, in, last_out,
+                       cmdlist == NULL ? infilename : NULL,
+                       i == 0 ? outfilename : NULL, &sched[i]);
+    job_setpid(job, cmdAmount - 1 - i, pid);
+
+    if(in != -1) {
+      close(in);
+    }
+    if(last_out != -1) {
+      close(last_out);
+    }
+
+    // Update last_out for next command
+    last_out = out;
+  }
+
+  // The relay must run before a builtin in the shell can block on it
+  if (meter != NULL && meter_start(meter, background) < 0)
+    meter = NULL;
+
+  // Everything it reads from or writes to is running by now
+  if (inshell.b != NULL) {
+    job_stagestart(job, inshell.stage, *inshell.cmd);
+    status = runbuiltin(inshell.b, inshell.cmd, inshell.in, inshell.out,
+                        inshell.stage == 0 ? infilename : NULL,
+                        inshell.stage == cmdAmount - 1 ? outfilename : NULL);
+    job_setstatus(job, inshell.stage, status);
+    if (inshell.in != -1)
+      close(inshell.in);
+    if (inshell.out != -1)
+      close(inshell.out);
+  }
+  for (i = 0; i < nthreads; i++)
+    pthread_join(threads[i].tid, NULL);
+  if (cmdlist != NULL && herefd != -1) // Gave up before the first command
+    close(herefd);
+
+  if(!background){ // Wait for all processes
+    status = job_wait(job);
+    if (meter != NULL)
+      meter_join(meter);
+    if (trace_on) {
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      trace_span(job->cmdline, start, end, 0, status);
+    }
+    job_free(job);
+    return status;
+  }
+  if (jobs_verbose)
+    printf("[%d] %d\n", job->id, (int) job->stages[cmdAmount-1].pid);
+  return 0; // Reaped later by jobs_reap
+}
+
+/* --- execute a shell command --- */
+int executeshellcmd(Shellcmd *shellcmd)
+{
+  return executeto(shellcmd, -1);
+}
+
+/*
+ * executeto : as executeshellcmd, with the last command's stdout on
+ * out (-1: the shell's own) unless the line redirects it. $... words
+ * and then wildcards are expanded here, into storage that lasts for
+ * this run only, so a parsed command can run again with fresh output.
+ */
+int executeto(Shellcmd *shellcmd, int out)
+{
+  Arena words = { 0 };
+  Cmd *cmds = wildcard_cmds(&words, subst_cmds(&words, shellcmd->the_cmds));
+  char *here = shellcmd->rd_here;
+  size_t herelen = shellcmd->rd_herelen;
+  int status;
+
+  if (shellcmd->rd_heredelim == NULL && here != NULL && subst_has(here)) {
+    // <<< word (here holds it and a newline): expanded but not split
+    char *w = subst_word(&words, arena_strndup(&words, here, herelen - 1));
+    shellcmd->rd_herelen = strlen(w) + 1;
+    shellcmd->rd_here = arena_alloc(&words, shellcmd->rd_herelen + 1);
+    stpcpy(stpcpy(shellcmd->rd_here, w), "\n");
+  }
+  status = execute(shellcmd, cmds, out);
+  shellcmd->rd_here = here;
+  shellcmd->rd_herelen = herelen;
+
+  arena_free(&words);
+  return status;
+}
+
+/*
+ * runparts : run a line holding a ; as one line per part, in order,
+ * as sh does. A << body follows the line, so only the last part may
+ * open one; otherwise nothing runs. Returns 1 when the shell should stop.
+ */
+static int runparts(char *cmdline, Shellcmd *shellcmd)
+{
+  char *copy, *part, *end, *delim;
+  int i, n = 1, stop = 0;
+
+  if ((copy = strdup(cmdline)) == NULL) {
+    fprintf(stderr, "%s\n", strerror(errno));
+    shell_status = 1;
+    return 0;
+  }
+  for (end = copy; (end = plan_semicolon(end)) != NULL; n++)
+    *end++ = '\0';
+  for (i = 0, part = copy; i < n - 1; i++, part += strlen(part) + 1) {
+    if ((delim = plan_heredelim(part)) != NULL) {
+      fprintf(stderr, "<<%s: the here-document must be on the last part of the line\n", delim);
+      free(delim);
+      free(copy);
+      shell_status = 2; // As sh does for a syntax error
+      return 0;
+    }
+  }
+  for (i = 0, part = copy; i < n && !stop; i++, part += strlen(part) + 1)
+    stop = runline(part, shellcmd);
+  free(copy);
+  return stop;
+}
+
+/* --- run one line of input: returns 1 when the shell should stop --- */
+int runline(char *cmdline, Shellcmd *shellcmd)
+{
+  if (heredocpending(shellcmd)) {
+    // Inside a << body: run the command once its delimiter turns up
+    int done = heredocline(shellcmd, cmdline);
+    if (done > 0)
+      shell_status = executeshellcmd(shellcmd);
+    else if (done < 0) // Out of memory: the command was dropped
+      shell_status = 1;
+    return shell_terminate;
+  }
+  if (plan_collect(cmdline)) { // A line of a for or while loop
+    if (!plan_pending())
+      shell_status = plan_run();
+    return shell_terminate;
+  }
+
+  jobs_reap();
+  while (isspace(*cmdline))
+    cmdline++;
+  if (*cmdline == '\0' || *cmdline == '#') // Blank line or comment
+    return 0;
+  if (plan_semicolon(cmdline) != NULL) // a; b
+    return runparts(cmdline, shellcmd);
+  trace_begin("parse");
+  int parsed = parsecommand(cmdline, shellcmd);
+  trace_end("parse");
+  if (parsed <= 0)
+    shell_status = 2; // As sh does for a syntax error
+  else if (!heredocpending(shellcmd))
+    shell_status = executeshellcmd(shellcmd);
+  return shell_terminate;
+}
+
+/* --- end of input: a << body still open ends here, as in sh; an
+   unfinished loop is dropped --- */
+int runeof(Shellcmd *shellcmd)
+{
+  if (heredocpending(shellcmd) && !shell_terminate) {
+    fprintf(stderr, "here-document delimited by end of input (wanted %s)\n",
+            shellcmd->rd_heredelim);
+    runline(shellcmd->rd_heredelim, shellcmd);
+  }
+  if (plan_pending()) {
+    fprintf(stderr, "for or while without done at end of input\n");
+    plan_discard();
+  }
+  return 0;
+}
+
+/*
+ * runscript : run every line of a script. A named script is read
+ * through a large stdio buffer. Commands share stdin with the shell,
+ * so there it must not read past the line it runs: a pipe is read
+ * unbuffered, and a file is rewound to the end of the line before it
+ * runs, so that the next line is read from wherever they left off.
+ */
+int runscript(FILE *file, Shellcmd *shellcmd)
+{
+  char *line = NULL;
+  size_t size = 0;
+  ssize_t len;
+  int shared = fileno(file) == STDIN_FILENO, seekable = 0;
+
+  if (!shared)
+    setvbuf(file, NULL, _IOFBF, SCRIPTBUFFER);
+  else if (!(seekable = lseek(STDIN_FILENO, 0, SEEK_CUR) >= 0))
+    setvbuf(file, NULL, _IONBF, 0);
+  while ((len = getline(&line, &size, file)) >= 0) {
+    if (len > 0 && line[len-1] == '\n')
+      line[len-1] = '\0';
+    if (seekable) // Drops what was read ahead and moves the offset back
+      fflush(file);
+    if (runline(line, shellcmd))
+      break;
+  }
+  free(line);
+  return runeof(shellcmd);
+}
+
+/* --- run the lines of a -c argument --- */
+int runstring(char *cmds, Shellcmd *shellcmd)
+{
+  char *line, *next;
+
+  for (line = cmds; line != NULL; line = next) {
+    next = strchr(line, '\n');
+    if (next != NULL)
+      *next++ = '\0';
+    if (runline(line, shellcmd))
+      break;
+  }
+  return runeof(shellcmd);
+}
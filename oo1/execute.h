@@ -0,0 +1,20 @@
+/*
+
+   execute.h
+
+ */
+
+#ifndef _EXECUTE_H
+#define _EXECUTE_H
+
+#include <stdio.h>
+#include "parser.h"
+
+int executeshellcmd(Shellcmd *);
+int executeto(Shellcmd *, int);
+int runline(char *, Shellcmd *);
+int runscript(FILE *, Shellcmd *);
+int runstring(char *, Shellcmd *);
+int runeof(Shellcmd *);
+
+#endif
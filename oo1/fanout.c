@@ -0,0 +1,177 @@
+/*
+
+   fanout.c
+
+   tee(2) duplicates pipe buffers by reference without consuming them,
+   splice(2) moves them. A tee into a pipe that is partly full may stop
+   halfway, and a retry would start over from the first byte, so every
+   output but the last gets a private, empty staging pipe as large as
+   the input: a tee into it always takes the whole round. Each round:
+
+     tee    in      -> stage[i]   for every output but the last
+     splice in      -> outs[n-1]  consumes the round from the input
+     splice stage[i]-> outs[i]    blocking until the round is through
+
+   Input that is not a pipe (a file, a terminal) is first spliced into
+   a pipe of our own. No byte is copied through user space.
+
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "fanout.h"
+
+/* --- move n bytes from pipe `from` to `to`; returns what is left --- */
+static size_t splicen(int from, int to, size_t n)
+{
+  while (n > 0) {
+    ssize_t k = splice(from, NULL, to, NULL, n, SPLICE_F_MOVE);
+    if (k < 0 && errno == EINTR)
+      continue;
+    if (k <= 0)
+      break;
+    n -= k;
+  }
+  return n;
+}
+
+/* --- throw away n queued bytes (only after a reader quit) --- */
+static void discard(int fd, size_t n)
+{
+  char buf[4096];
+
+  while (n > 0) {
+    ssize_t k = read(fd, buf, n < sizeof(buf) ? n : sizeof(buf));
+    if (k <= 0)
+      return;
+    n -= k;
+  }
+}
+
+/*
+ * fanout : copy everything readable from in to each of the n fds in
+ * outs until EOF. An output whose reader has gone away is dropped and
+ * set to -1. Returns bytes read from in, or -1 on error.
+ */
+ssize_t fanout(int in, int *outs, int n)
+{
+  struct stat sb;
+  int stage[n][2];
+  int src[2] = { -1, -1 };
+  int i, last, rd = in;
+  ssize_t total = 0, got, k;
+  long size;
+
+  if (fstat(in, &sb) < 0)
+    return -1;
+  if (!S_ISFIFO(sb.st_mode)) { // tee needs a pipe on its input side
+    if (pipe2(src, O_CLOEXEC) < 0)
+      return -1;
+    rd = src[0];
+  }
+  size = fcntl(rd, F_GETPIPE_SZ);
+
+  for (i = 0; i < n; i++)
+    stage[i][0] = stage[i][1] = -1;
+  for (i = 0; i < n - 1; i++) {
+    if (pipe2(stage[i], O_CLOEXEC) < 0) {
+      total = -1;
+      goto out;
+    }
+    fcntl(stage[i][1], F_SETPIPE_SZ, size);
+  }
+
+  for (;;) {
+    for (last = n - 1; last >= 0 && outs[last] == -1; last--);
+    if (last < 0) // Every reader has quit
+      break;
+
+    got = 0;
+    if (src[0] != -1) { // Fill our own pipe from the file first
+      do
+        got = splice(in, NULL, src[1], NULL, size, SPLICE_F_MOVE);
+      while (got < 0 && errno == EINTR);
+      if (got <= 0) {
+        total = got < 0 ? -1 : total;
+        break;
+      }
+    }
+
+    // Copies for all but the last output; the first tee sizes the round
+    for (i = 0; i < last; i++) {
+      if (outs[i] == -1)
+        continue;
+      do
+        k = tee(rd, stage[i][1], got ? got : size, 0);
+      while (k < 0 && errno == EINTR);
+      if (k <= 0 || (got && k != got)) { // Error, EOF or a short copy
+        got = k <= 0 ? k : -1;
+        break;
+      }
+      got = k;
+    }
+    if (got < 0) {
+      total = -1;
+      break;
+    }
+
+    // The last output consumes the round from the input
+    if (got == 0) { // Nothing teed: one output left, move what is there
+      do
+        got = splice(rd, NULL, outs[last], NULL, size, SPLICE_F_MOVE);
+      while (got < 0 && errno == EINTR);
+      if (got == 0)
+        break; // EOF
+      if (got < 0) {
+        if (errno != EPIPE) {
+          total = -1;
+          break;
+        }
+        outs[last] = -1; // Reader quit
+        continue;
+      }
+    }
+    else if ((k = splicen(rd, outs[last], got)) > 0) {
+      if (errno != EPIPE) {
+        total = -1;
+        break;
+      }
+      outs[last] = -1; // Reader quit: drop the rest of its round
+      discard(rd, k);
+    }
+
+    for (i = 0; i < last; i++) {
+      if (outs[i] == -1)
+        continue;
+      if ((k = splicen(stage[i][0], outs[i], got)) > 0) {
+        if (errno != EPIPE) {
+          total = -1;
+          goto out;
+        }
+        outs[i] = -1;
+        discard(stage[i][0], k);
+      }
+    }
+    total += got;
+  }
+
+ out:
+  for (i = 0; i < n - 1; i++) {
+    if (stage[i][0] != -1)
+      close(stage[i][0]);
+    if (stage[i][1] != -1)
+      close(stage[i][1]);
+  }
+  if (src[0] != -1) {
+    close(src[0]);
+    close(src[1]);
+  }
+  return total;
+}
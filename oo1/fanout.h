@@ -0,0 +1,16 @@
+/*
+
+   fanout.h
+
+   Duplicate one stream into several pipes inside the kernel.
+
+ */
+
+#ifndef _FANOUT_H
+#define _FANOUT_H
+
+#include <sys/types.h>
+
+ssize_t fanout(int, int *, int);
+
+#endif
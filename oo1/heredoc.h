@@ -0,0 +1,16 @@
+/*
+
+   heredoc.h
+
+   Here-documents and here-strings as sealed in-memory files.
+
+ */
+
+#ifndef _HEREDOC_H
+#define _HEREDOC_H
+
+#include <stddef.h>
+
+int heredoc_open(const char *, size_t);
+
+#endif
@@ -0,0 +1,399 @@
+/*
+
+   jobs.c
+
+   Each started stage gets a pidfd. A pidfd turns readable when its
+   process exits, so the shell can wait for a foreground pipeline with
+   one poll() and pick up finished background stages from an epoll set
+   without ever blocking in waitpid. Kernels without pidfd_open fall
+   back to plain waitpid.
+
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+
+#include "jobs.h"
+#include "acct.h"
+#include "trace.h"
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+/* --- symbolic constants --- */
+#define REAPMAX 64
+
+int jobs_verbose = 0;
+
+/* --- background jobs, in start order --- */
+static Job **jobtab;
+static int njobs, jobcap;
+static int epfd = -1;
+
+static int pidfd_open(pid_t pid)
+{
+  return syscall(SYS_pidfd_open, pid, 0);
+}
+
+/* --- the epoll set holding the pidfds of background stages --- */
+int jobs_pollfd(void)
+{
+  if (epfd == -1)
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+  return epfd;
+}
+
+/* --- job_new: create a job for a pipeline of nstages stages; NULL if out of memory --- */
+Job *job_new(int nstages, char *cmdline, int background)
+{
+  int i;
+  Job *j = malloc(sizeof(Job));
+  if (j == NULL)
+    return NULL;
+  j->stages = malloc(nstages * sizeof(JobStage));
+  j->cmdline = strdup(cmdline);
+  if (j->stages == NULL || j->cmdline == NULL) {
+    free(j->stages);
+    free(j->cmdline);
+    free(j);
+    return NULL;
+  }
+  j->nstages = nstages;
+  j->running = 0;
+  j->background = background;
+  j->timed = 0;
+  j->id = 0;
+
+  for (i = 0; i < nstages; i++) {
+    j->stages[i].job = j;
+    j->stages[i].pid = -1;
+    j->stages[i].pidfd = -1;
+    j->stages[i].status = 0;
+    j->stages[i].done = 1;
+    j->stages[i].name = NULL;
+    memset(&j->stages[i].start, 0, sizeof(struct timespec));
+    memset(&j->stages[i].end, 0, sizeof(struct timespec));
+    memset(&j->stages[i].ru, 0, sizeof(struct rusage));
+  }
+  acct_pipeline();
+
+  if (background) {
+    if (njobs == jobcap) {
+      jobcap = jobcap ? jobcap * 2 : 16;
+      jobtab = realloc(jobtab, jobcap * sizeof(Job *));
+    }
+    j->id = njobs > 0 ? jobtab[njobs-1]->id + 1 : 1;
+    jobtab[njobs++] = j;
+  }
+  return j;
+}
+
+/*
+ * job_stagestart : stage i, running name, is about to start. For a
+ * builtin the shell thread's own usage so far is kept in ru, so that
+ * job_setstatus can charge the difference to the stage.
+ */
+void job_stagestart(Job *j, int i, char *name)
+{
+  JobStage *st = &j->stages[i];
+
+  st->name = strdup(name);
+  clock_gettime(CLOCK_MONOTONIC, &st->start);
+  getrusage(RUSAGE_THREAD, &st->ru);
+}
+
+/* --- job_setpid: record the process running stage i --- */
+void job_setpid(Job *j, int i, pid_t pid)
+{
+  JobStage *st = &j->stages[i];
+
+  if (pid <= 0)
+    return;
+  st->pid = pid;
+  st->done = 0;
+  st->pidfd = pidfd_open(pid); // CLOEXEC by default
+  j->running++;
+
+  if (j->background && st->pidfd != -1 && jobs_pollfd() != -1) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = st;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, st->pidfd, &ev);
+  }
+}
+
+/* --- collect one stage: returns 1 once it has been reaped --- */
+static int stage_reap(JobStage *st, int flags)
+{
+  pid_t r;
+
+  if (st->done)
+    return 1;
+  do
+    r = wait4(st->pid, &st->status, flags, &st->ru);
+  while (r < 0 && errno == EINTR);
+  if (r == 0)
+    return 0;
+  if (r < 0) { // Someone else reaped it
+    st->status = 0;
+    memset(&st->ru, 0, sizeof(struct rusage));
+  }
+  clock_gettime(CLOCK_MONOTONIC, &st->end);
+  acct_stage(st);
+  trace_span(st->name ? st->name : "?", st->start, st->end, st->pid,
+             WIFSIGNALED(st->status) ? 128 + WTERMSIG(st->status) : WEXITSTATUS(st->status));
+
+  st->done = 1;
+  if (st->pidfd != -1) // Closing also drops it from the epoll set
+    close(st->pidfd);
+  st->pidfd = -1;
+  st->job->running--;
+  return 1;
+}
+
+/* --- job_wait: block until every stage of j has exited --- */
+int job_wait(Job *j)
+{
+  int i, n;
+
+  while (j->running > 0) {
+    struct pollfd pfd[j->nstages];
+    JobStage *st[j->nstages];
+
+    for (i = 0, n = 0; i < j->nstages; i++) {
+      if (j->stages[i].done)
+        continue;
+      if (j->stages[i].pidfd == -1) { // No pidfd: plain blocking wait
+        stage_reap(&j->stages[i], 0);
+        continue;
+      }
+      pfd[n].fd = j->stages[i].pidfd;
+      pfd[n].events = POLLIN;
+      st[n++] = &j->stages[i];
+    }
+    if (n == 0)
+      continue;
+    if (poll(pfd, n, -1) < 0)
+      continue; // EINTR: Ctrl + C reaches the children as well
+    for (i = 0; i < n; i++)
+      if (pfd[i].revents)
+        stage_reap(st[i], 0);
+  }
+  return job_status(j);
+}
+
+/* --- job_check: reap the stages of j that have exited; how many still run --- */
+int job_check(Job *j)
+{
+  int i;
+
+  for (i = 0; i < j->nstages; i++)
+    if (!j->stages[i].done)
+      stage_reap(&j->stages[i], WNOHANG);
+  return j->running;
+}
+
+/*
+ * job_waitany : block until one of the n jobs in js has finished and
+ * return its index. Jobs that are already done count as finished.
+ */
+int job_waitany(Job **js, int n)
+{
+  int i, k, m;
+
+  for (;;) {
+    int total = 0;
+    for (i = 0; i < n; i++) {
+      if (js[i]->running == 0)
+        return i;
+      total += js[i]->nstages;
+    }
+
+    struct pollfd pfd[total];
+    JobStage *st[total];
+    for (i = 0, m = 0; i < n; i++) {
+      for (k = 0; k < js[i]->nstages; k++) {
+        JobStage *s = &js[i]->stages[k];
+        if (s->done)
+          continue;
+        if (s->pidfd == -1) { // No pidfd: wait for this one directly
+          stage_reap(s, 0);
+          continue;
+        }
+        pfd[m].fd = s->pidfd;
+        pfd[m].events = POLLIN;
+        st[m++] = s;
+      }
+    }
+    if (m == 0 || poll(pfd, m, -1) < 0)
+      continue;
+    for (i = 0; i < m; i++)
+      if (pfd[i].revents)
+        stage_reap(st[i], 0);
+  }
+}
+
+/* --- job_setstatus: stage i ran inside the shell and returned code --- */
+void job_setstatus(Job *j, int i, int code)
+{
+  JobStage *st = &j->stages[i];
+  struct rusage now;
+
+  st->pid = 0;
+  st->status = (code & 0xff) << 8; // Same encoding as wait()
+  st->done = 1;
+
+  clock_gettime(CLOCK_MONOTONIC, &st->end);
+  getrusage(RUSAGE_THREAD, &now);
+  acct_sub(&now, &st->ru);
+  st->ru = now;
+  acct_stage(st);
+  trace_span(st->name, st->start, st->end, 0, code & 0xff);
+}
+
+/* --- job_status: exit status of the pipeline (its last stage) --- */
+int job_status(Job *j)
+{
+  JobStage *st = &j->stages[j->nstages-1];
+
+  if (st->pid == -1)
+    return 127;
+  if (WIFSIGNALED(st->status))
+    return 128 + WTERMSIG(st->status);
+  return WEXITSTATUS(st->status);
+}
+
+/* --- job_free: forget j; stages still running are not waited for --- */
+void job_free(Job *j)
+{
+  int i;
+
+  if (j->timed && j->running == 0)
+    acct_time(j, 2);
+
+  for (i = 0; i < njobs; i++) {
+    if (jobtab[i] == j) {
+      memmove(&jobtab[i], &jobtab[i+1], (njobs - i - 1) * sizeof(Job *));
+      njobs--;
+      break;
+    }
+  }
+  for (i = 0; i < j->nstages; i++) {
+    if (j->stages[i].pidfd != -1)
+      close(j->stages[i].pidfd);
+    free(j->stages[i].name);
+  }
+  free(j->stages);
+  free(j->cmdline);
+  free(j);
+}
+
+/* --- jobs_reap: collect finished background stages without blocking --- */
+void jobs_reap(void)
+{
+  struct epoll_event ev[REAPMAX];
+  int i, k, n;
+
+  if (njobs == 0)
+    return;
+  if (epfd != -1) {
+    do {
+      n = epoll_wait(epfd, ev, REAPMAX, 0);
+      for (i = 0; i < n; i++)
+        stage_reap(ev[i].data.ptr, WNOHANG);
+    } while (n == REAPMAX);
+  }
+
+  for (i = 0; i < njobs; ) {
+    Job *j = jobtab[i];
+    for (k = 0; k < j->nstages; k++) // Stages without a pidfd
+      if (!j->stages[k].done && j->stages[k].pidfd == -1)
+        stage_reap(&j->stages[k], WNOHANG);
+    if (j->running > 0) {
+      i++;
+      continue;
+    }
+    if (jobs_verbose)
+      printf("[%d] Done\t%s\n", j->id, j->cmdline);
+    job_free(j);
+  }
+}
+
+static Job *job_find(char *arg)
+{
+  int i, id;
+
+  if (arg == NULL)
+    return njobs > 0 ? jobtab[njobs-1] : NULL;
+  if (*arg == '%')
+    arg++;
+  id = atoi(arg);
+  for (i = 0; i < njobs; i++)
+    if (jobtab[i]->id == id)
+      return jobtab[i];
+  return NULL;
+}
+
+/* --- jobs_list: write the running background jobs to out --- */
+int jobs_list(int out)
+{
+  int i;
+
+  jobs_reap();
+  for (i = 0; i < njobs; i++)
+    if (dprintf(out, "[%d] Running\t%s\n", jobtab[i]->id, jobtab[i]->cmdline) < 0)
+      return 1;
+  return 0;
+}
+
+/* --- jobs_waitfor: wait for the given jobs, or for all of them --- */
+int jobs_waitfor(char **ids)
+{
+  int status = 0;
+  Job *j;
+
+  if (*ids == NULL) {
+    while (njobs > 0) {
+      status = job_wait(jobtab[0]);
+      job_free(jobtab[0]);
+    }
+    return status;
+  }
+  for (; *ids != NULL; ids++) {
+    if ((j = job_find(*ids)) == NULL) {
+      fprintf(stderr, "wait: %s: no such job\n", *ids);
+      status = 127;
+      continue;
+    }
+    status = job_wait(j);
+    job_free(j);
+  }
+  return status;
+}
+
+/* --- jobs_foreground: wait for job id (default: the newest one) --- */
+int jobs_foreground(char *id, int out)
+{
+  int status;
+  Job *j;
+
+  if ((j = job_find(id)) == NULL) {
+    fprintf(stderr, "fg: %s: no such job\n", id ? id : "current");
+    return 1;
+  }
+  dprintf(out, "%s\n", j->cmdline);
+  status = job_wait(j);
+  job_free(j);
+  return status;
+}
@@ -0,0 +1,60 @@
+/*
+
+   jobs.h
+
+   Job table: every pipeline started by executeshellcmd is a job with
+   one pidfd per stage. Foreground jobs are waited for by polling their
+   pidfds, background jobs are reaped from the main loop. Stages are
+   reaped with wait4 so their resource usage ends up in acct.c.
+
+ */
+
+#ifndef _JOBS_H
+#define _JOBS_H
+
+#include <time.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+struct _job;
+
+typedef struct _jobstage {
+    struct _job *job;
+    pid_t pid;     /* -1 when the stage never started, 0 for a builtin */
+    int pidfd;     /* -1 once reaped, or when pidfds are unavailable */
+    int status;    /* wait status, valid once reaped */
+    int done;
+    char *name;    /* argv[0] */
+    struct timespec start, end;
+    struct rusage ru; /* from wait4, or measured around a builtin */
+} JobStage;
+
+typedef struct _job {
+    int id;        /* [id] as shown by jobs */
+    int background;
+    int timed;     /* report resource usage when done */
+    int nstages;
+    int running;   /* stages not reaped yet */
+    char *cmdline;
+    JobStage *stages; /* in pipeline order */
+} Job;
+
+extern int jobs_verbose; /* report started/finished background jobs */
+
+Job *job_new(int, char *, int);
+void job_stagestart(Job *, int, char *);
+void job_setpid(Job *, int, pid_t);
+void job_setstatus(Job *, int, int);
+int job_wait(Job *);
+int job_check(Job *);
+int job_waitany(Job **, int);
+int job_status(Job *);
+void job_free(Job *);
+
+int jobs_pollfd(void);
+void jobs_reap(void);
+int jobs_list(int);
+int jobs_waitfor(char **);
+int jobs_foreground(char *, int);
+
+#endif
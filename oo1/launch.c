@@ -0,0 +1,263 @@
+/*
+
+   launch.c
+
+   Launch one pipeline stage. The default path uses posix_spawn, which
+   glibc implements with clone(CLONE_VM|CLONE_VFORK), so the shell's
+   page tables are never copied; pipe fds and < / > redirections are
+   set up with file actions. The old fork path is kept as a fallback
+   (BOSH_SPAWN=fork selects it for every stage). BOSH_SPAWN=zygote
+   hands every stage to the fork server in zygote.c instead. All exec
+   the file found through the PATH cache in pathhash.c. spawnstage
+   also places the command on CPUs and at a nice value (affinity.c).
+
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <spawn.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+#include "launch.h"
+#include "redirect.h"
+#include "pathhash.h"
+#include "zygote.h"
+#include "trace.h"
+#include "affinity.h"
+
+extern char **environ;
+
+/* --- symbolic constants --- */
+#define TRACELABEL 64
+
+int spawn_mode = SPAWN_POSIX;
+
+/* --- latency accounting per launch path --- */
+static const char *spawn_names[SPAWN_MODES] = { "posix_spawn", "fork", "zygote" };
+static unsigned long spawn_count[SPAWN_MODES];
+static double spawn_usec[SPAWN_MODES];
+
+static double now_usec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void spawn_report_atexit(void)
+{
+  spawn_report(2);
+}
+
+/* --- pick the launch path from the environment --- */
+void spawn_init(void)
+{
+  char *mode = getenv("BOSH_SPAWN");
+  if (mode != NULL && strcmp(mode, "fork") == 0)
+    spawn_mode = SPAWN_FORK;
+  else if (mode != NULL && strcmp(mode, "zygote") == 0 && zygote_start() == 0)
+    spawn_mode = SPAWN_ZYGOTE;
+  else
+    spawn_mode = SPAWN_POSIX;
+
+  // BOSH_SPAWNSTATS: print spawn latency per path when the shell exits
+  if (getenv("BOSH_SPAWNSTATS") != NULL)
+    atexit(spawn_report_atexit);
+}
+
+/* --- report why a stage could not be started --- */
+static void spawn_error(char *argv[], char *infilename, int err)
+{
+  if (infilename != NULL && access(infilename, F_OK) != 0)
+    fprintf(stderr, "%s: %s\n", infilename, strerror(errno));
+  else if (err == ENOENT)
+    fprintf(stderr, "Command not found.\n");
+  else
+    fprintf(stderr, "%s: %s\n", argv[0], strerror(err));
+}
+
+/* --- posix_spawn path: returns 0 or an errno value --- */
+static int spawn_posix(pid_t *pid, char *path, char *argv[], int in, int out,
+                       char *infilename, char *outfilename, StageSched *s)
+{
+  posix_spawn_file_actions_t fa;
+  posix_spawnattr_t attr;
+  sigset_t def;
+  cpu_set_t saved;
+  int err, entered = 0;
+
+  if ((err = posix_spawn_file_actions_init(&fa)) != 0)
+    return err;
+  if ((err = posix_spawnattr_init(&attr)) != 0) {
+    posix_spawn_file_actions_destroy(&fa);
+    return err;
+  }
+
+  if (infilename != NULL)
+    err = posix_spawn_file_actions_addopen(&fa, 0, infilename, O_RDONLY, 0);
+  else if (in != -1)
+    err = posix_spawn_file_actions_adddup2(&fa, in, 0);
+  if (err == 0 && outfilename != NULL)
+    err = posix_spawn_file_actions_addopen(&fa, 1, outfilename, OUTMODE, OUTPERM);
+  else if (err == 0 && out != -1)
+    err = posix_spawn_file_actions_adddup2(&fa, out, 1);
+
+  // The shell's own dispositions must not leak into the command
+  sigemptyset(&def);
+  sigaddset(&def, SIGINT);
+  sigaddset(&def, SIGPIPE);
+  if (err == 0)
+    err = posix_spawnattr_setsigdefault(&attr, &def);
+  if (err == 0)
+    err = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF);
+
+  // The child inherits the CPU mask of this thread at clone
+  if (err == 0 && s != NULL)
+    entered = affinity_enter(s, &saved, argv[0]);
+  if (err == 0)
+    err = posix_spawn(pid, path, &fa, &attr, argv, environ);
+  if (entered)
+    affinity_leave(&saved);
+  // A nice value raised in the shell could not be lowered again
+  if (err == 0 && s != NULL && s->renice &&
+      setpriority(PRIO_PROCESS, *pid, s->nice) < 0)
+    fprintf(stderr, "%s: nice: %s\n", argv[0], strerror(errno));
+
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&fa);
+  return err;
+}
+
+/* --- fork path: returns 0 or an errno value --- */
+static int spawn_fork(pid_t *pid, char *path, char *argv[], int in, int out,
+                      char *infilename, char *outfilename, StageSched *s)
+{
+  *pid = fork();
+  if (*pid < 0)
+    return errno;
+  if (*pid == 0) { // child
+    signal(SIGINT, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    if (affinity_any(s))
+      affinity_apply(0, s, argv[0]);
+    if (infilename != NULL && (in = open(infilename, O_RDONLY)) < 0) {
+      fprintf(stderr, "%s: %s\n", infilename, strerror(errno));
+      _exit(1);
+    }
+    if (outfilename != NULL && (out = open(outfilename, OUTMODE, OUTPERM)) < 0) {
+      fprintf(stderr, "%s: %s\n", outfilename, strerror(errno));
+      _exit(1);
+    }
+    redirect_stdinandout(in, out);
+    execv(path, argv); // Execute current command
+    fprintf(stderr, "Command not found.\n");
+    _exit(127);
+  }
+  return 0;
+}
+
+/* --- trace a spawn on the shell's row and the exec on the child's --- */
+static void spawntrace(int mode, char *name, char *path, struct timespec start, pid_t pid)
+{
+  char label[TRACELABEL];
+  struct timespec end;
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  snprintf(label, sizeof(label), "%s %s", spawn_names[mode], name);
+  trace_span(label, start, end, 0, pid > 0 ? 0 : 127);
+  if (pid > 0) {
+    // posix_spawn and the fork server return after the exec; fork before
+    snprintf(label, sizeof(label), "%s %s", mode == SPAWN_FORK ? "fork" : "exec", path);
+    trace_instant(label, pid);
+  }
+}
+
+/*
+ * spawncmd : start argv with stdin/stdout taken from in/out (-1 keeps the
+ * shell's), or opened from infilename/outfilename when those are given.
+ * Pipe fds passed in should be close-on-exec; the child only keeps the
+ * copies placed on 0 and 1. Returns the pid, or -1 when nothing started.
+ */
+pid_t spawncmd(char *argv[], int in, int out, char *infilename, char *outfilename)
+{
+  return spawnstage(argv, in, out, infilename, outfilename, NULL);
+}
+
+/* --- spawncmd, running the command as s says (NULL: as the shell) --- */
+pid_t spawnstage(char *argv[], int in, int out, char *infilename,
+                 char *outfilename, StageSched *s)
+{
+  pid_t pid = -1;
+  int mode = spawn_mode;
+  int err;
+  char *path = path_lookup(argv[0]);
+  double t0 = now_usec();
+  struct timespec start;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  if (!affinity_any(s))
+    s = NULL;
+  if (path == NULL) { // Cached or fresh miss: nothing to exec
+    spawn_error(argv, NULL, ENOENT);
+    return -1;
+  }
+
+  if (mode == SPAWN_ZYGOTE) {
+    err = zygote_spawn(&pid, path, argv, in, out, infilename, outfilename, s);
+    if (err == ENOENT && path != argv[0] && access(path, F_OK) != 0) {
+      path_forget(argv[0]);
+      if ((path = path_lookup(argv[0])) != NULL)
+        err = zygote_spawn(&pid, path, argv, in, out, infilename, outfilename, s);
+    }
+    if (err == ENOSYS) // The fork server is gone
+      mode = spawn_mode = SPAWN_POSIX;
+  }
+  if (mode == SPAWN_POSIX) {
+    err = spawn_posix(&pid, path, argv, in, out, infilename, outfilename, s);
+    if (err == ENOENT && path != argv[0] && access(path, F_OK) != 0) {
+      // The cached file is gone: look the command up again
+      path_forget(argv[0]);
+      if ((path = path_lookup(argv[0])) != NULL)
+        err = spawn_posix(&pid, path, argv, in, out, infilename, outfilename, s);
+    }
+    if (err == ENOMEM || err == ENOSYS) // file actions unusable: fall back
+      mode = SPAWN_FORK;
+  }
+  if (mode == SPAWN_FORK)
+    err = spawn_fork(&pid, path, argv, in, out, infilename, outfilename, s);
+
+  spawn_count[mode]++;
+  spawn_usec[mode] += now_usec() - t0;
+  if (trace_on)
+    spawntrace(mode, argv[0], path, start, err == 0 ? pid : -1);
+
+  if (err != 0) {
+    spawn_error(argv, infilename, err);
+    return -1;
+  }
+  return pid;
+}
+
+/* --- write spawn latency per launch path to fd --- */
+int spawn_report(int fd)
+{
+  int i;
+  for (i = 0; i < SPAWN_MODES; i++) {
+    if (spawn_count[i] == 0)
+      continue;
+    if (dprintf(fd, "%-12s %8lu spawns %12.1f us total %10.2f us/spawn\n",
+                spawn_names[i], spawn_count[i], spawn_usec[i],
+                spawn_usec[i] / spawn_count[i]) < 0)
+      return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,32 @@
+/*
+
+   launch.h
+
+ */
+
+#ifndef _LAUNCH_H
+#define _LAUNCH_H
+
+#include <fcntl.h>
+#include <sys/types.h>
+
+/* --- launch paths --- */
+#define SPAWN_POSIX 0 /* posix_spawn with file actions (vfork+exec) */
+#define SPAWN_FORK  1 /* fork, redirect_stdinandout, execvp */
+#define SPAWN_ZYGOTE 2 /* ask the fork server (zygote.c) */
+#define SPAWN_MODES 3
+
+/* --- how > opens its file --- */
+#define OUTMODE (O_WRONLY|O_CREAT|O_TRUNC)
+#define OUTPERM 0644
+
+struct _stagesched;
+
+extern int spawn_mode;
+
+void spawn_init(void);
+pid_t spawncmd(char *[], int, int, char *, char *);
+pid_t spawnstage(char *[], int, int, char *, char *, struct _stagesched *);
+int spawn_report(int);
+
+#endif
@@ -0,0 +1,280 @@
+/*
+
+   libbosh.c
+
+   The pipeline API on top of the shell's own layers: stages start
+   through spawncmd (posix_spawn, < and > opened in the child, PATH
+   cache), are joined by pipes from mkpipe and are tracked as a job
+   with a pidfd per stage. Nothing is parsed and no /bin/sh runs.
+
+   Those layers keep their state in globals (the PATH cache, the spawn
+   server, accounting), so one lock is held while a pipeline starts or
+   its stages are reaped. Waiting itself happens outside it, in
+   waitid with WNOWAIT, so a thread blocked in bosh_wait never holds
+   up the others.
+
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+#include "libbosh.h"
+#include "launch.h"
+#include "jobs.h"
+#include "pipes.h"
+
+struct _boshpipeline {
+    char ***stages;     /* copies of the argv arrays, in pipeline order */
+    int nstages, cap;
+    int in, out;        /* -1: the caller's own */
+    char *infile, *outfile;
+    Job *job;           /* once started */
+};
+
+/* --- held around everything that touches the shell's globals --- */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* --- bosh_new: an empty pipeline, reading and writing the caller's stdin/stdout --- */
+BoshPipeline *bosh_new(void)
+{
+  BoshPipeline *p = calloc(1, sizeof(BoshPipeline));
+
+  if (p != NULL)
+    p->in = p->out = -1;
+  return p;
+}
+
+/* --- bosh_add: append a stage running argv; 0 or -1 --- */
+int bosh_add(BoshPipeline *p, char *const argv[])
+{
+  char **copy;
+  int argc, i;
+
+  if (p->job != NULL || argv == NULL || argv[0] == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  for (argc = 0; argv[argc] != NULL; argc++)
+    ;
+  if ((copy = calloc(argc + 1, sizeof(char *))) == NULL)
+    return -1;
+  for (i = 0; i < argc; i++)
+    if ((copy[i] = strdup(argv[i])) == NULL) {
+      while (i > 0)
+        free(copy[--i]);
+      free(copy);
+      return -1;
+    }
+
+  if (p->nstages == p->cap) {
+    char ***stages = realloc(p->stages, (p->cap ? p->cap * 2 : 4) * sizeof(char **));
+    if (stages == NULL) {
+      for (i = 0; i < argc; i++)
+        free(copy[i]);
+      free(copy);
+      return -1;
+    }
+    p->stages = stages;
+    p->cap = p->cap ? p->cap * 2 : 4;
+  }
+  p->stages[p->nstages++] = copy;
+  return 0;
+}
+
+/* --- replace *name with a copy of file --- */
+static int setfile(char **name, const char *file)
+{
+  char *copy = NULL;
+
+  if (file != NULL && (copy = strdup(file)) == NULL)
+    return -1;
+  free(*name);
+  *name = copy;
+  return 0;
+}
+
+/*
+ * bosh_stdin : the first stage reads fd, or file when it is not NULL
+ * (-1 and NULL: the caller's stdin). The fd stays the caller's.
+ */
+int bosh_stdin(BoshPipeline *p, int fd, const char *file)
+{
+  if (p->job != NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  p->in = fd;
+  return setfile(&p->infile, file);
+}
+
+/* --- bosh_stdout: the same for what the last stage writes; file is truncated --- */
+int bosh_stdout(BoshPipeline *p, int fd, const char *file)
+{
+  if (p->job != NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  p->out = fd;
+  return setfile(&p->outfile, file);
+}
+
+/* --- the pipeline as a command line, for accounting and traces --- */
+static char *cmdline(BoshPipeline *p)
+{
+  size_t len = 1;
+  char **w, *text, *s;
+  int i;
+
+  for (i = 0; i < p->nstages; i++)
+    for (w = p->stages[i]; *w != NULL; w++)
+      len += strlen(*w) + 3;
+  if ((s = text = malloc(len)) == NULL)
+    return NULL;
+  *s = '\0';
+  for (i = 0; i < p->nstages; i++)
+    for (w = p->stages[i]; *w != NULL; w++)
+      s = stpcpy(stpcpy(s, w == p->stages[i] ? (i ? " | " : "") : " "), *w);
+  return text;
+}
+
+/* --- start every stage of p, with the lock held --- */
+static int start(BoshPipeline *p)
+{
+  char *text;
+  int fd[2], in, out, i, err = 0;
+  pid_t pid;
+
+  if ((text = cmdline(p)) == NULL)
+    return -1;
+  p->job = job_new(p->nstages, text, 0);
+  free(text);
+  if (p->job == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  // First to last: each stage gets the read end of the pipe before it
+  for (i = 0, in = p->in; i < p->nstages; i++) {
+    if (i + 1 < p->nstages) {
+      if (mkpipe(fd, pipe_size) < 0) { // Close-on-exec
+        err = errno;
+        break;
+      }
+      out = fd[1];
+    }
+    else
+      out = p->out;
+
+    job_stagestart(p->job, i, p->stages[i][0]);
+    pid = spawncmd(p->stages[i], in, out,
+                   i == 0 ? p->infile : NULL,
+                   i + 1 == p->nstages ? p->outfile : NULL);
+    job_setpid(p->job, i, pid);
+
+    if (i > 0)
+      close(in);
+    if (i + 1 < p->nstages) {
+      close(out);
+      in = fd[0];
+    }
+  }
+  if (err != 0) { // Stages already started see EOF and end
+    if (i > 0)
+      close(in);
+    job_wait(p->job);
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * bosh_start : start every stage and return without waiting. Returns
+ * 0, or -1 if a pipe could not be made; stages that could not start
+ * are reported on stderr and make the pipeline fail as in the shell.
+ */
+int bosh_start(BoshPipeline *p)
+{
+  int r;
+
+  if (p->job != NULL || p->nstages == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  pthread_mutex_lock(&lock);
+  r = start(p);
+  pthread_mutex_unlock(&lock);
+  return r;
+}
+
+/* --- bosh_poll: the exit status once every stage has exited, else -1 --- */
+int bosh_poll(BoshPipeline *p)
+{
+  int status;
+
+  if (p->job == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  pthread_mutex_lock(&lock);
+  status = job_check(p->job) > 0 ? -1 : job_status(p->job);
+  pthread_mutex_unlock(&lock);
+  return status;
+}
+
+/*
+ * bosh_wait : block until every stage has exited; the exit status.
+ * Each stage is waited for without the lock and without reaping it,
+ * then reaped by job_check with the lock held.
+ */
+int bosh_wait(BoshPipeline *p)
+{
+  siginfo_t si;
+  int i;
+
+  if (p->job == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  for (;;) {
+    int status = bosh_poll(p);
+    if (status != -1)
+      return status;
+    for (i = 0; i < p->job->nstages; i++)
+      if (!p->job->stages[i].done)
+        break;
+    if (i < p->job->nstages)
+      waitid(P_PID, p->job->stages[i].pid, &si, WEXITED|WNOWAIT);
+  }
+}
+
+/* --- bosh_free: wait for a started pipeline, then forget it --- */
+void bosh_free(BoshPipeline *p)
+{
+  char **w;
+  int i;
+
+  if (p == NULL)
+    return;
+  if (p->job != NULL) {
+    bosh_wait(p);
+    pthread_mutex_lock(&lock);
+    job_free(p->job);
+    pthread_mutex_unlock(&lock);
+  }
+  for (i = 0; i < p->nstages; i++) {
+    for (w = p->stages[i]; *w != NULL; w++)
+      free(*w);
+    free(p->stages[i]);
+  }
+  free(p->stages);
+  free(p->infile);
+  free(p->outfile);
+  free(p);
+}
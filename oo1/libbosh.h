@@ -0,0 +1,46 @@
+/*
+
+   libbosh.h
+
+   Run pipelines from C without a shell in between: stages are argv
+   arrays, stdin and stdout are fds or files, and a started pipeline
+   is polled or waited for like one of bosh's own jobs. Stages are
+   always programs (looked up in PATH), never bosh builtins, so that
+   starting one never blocks the caller.
+
+   Build with make lib; link with -lbosh -lpthread (libbosh.a or
+   libbosh.so).
+
+   Different pipelines may be started, polled and waited for from
+   different threads at once. One pipeline must not be used by two
+   threads at a time.
+
+     BoshPipeline *p = bosh_new();
+     bosh_add(p, (char *[]) { "sort", NULL });
+     bosh_add(p, (char *[]) { "uniq", "-c", NULL });
+     bosh_stdin(p, -1, "words.txt");
+     bosh_stdout(p, fd, NULL);
+     if (bosh_start(p) == 0)
+       status = bosh_wait(p);
+     bosh_free(p);
+
+ */
+
+#ifndef _LIBBOSH_H
+#define _LIBBOSH_H
+
+/* --- the shell's own symbols stay inside libbosh.so and libbosh.a --- */
+#define BOSH_API __attribute__((visibility("default")))
+
+typedef struct _boshpipeline BoshPipeline;
+
+BOSH_API BoshPipeline *bosh_new(void);
+BOSH_API int bosh_add(BoshPipeline *, char *const []);
+BOSH_API int bosh_stdin(BoshPipeline *, int, const char *);
+BOSH_API int bosh_stdout(BoshPipeline *, int, const char *);
+BOSH_API int bosh_start(BoshPipeline *);
+BOSH_API int bosh_poll(BoshPipeline *);
+BOSH_API int bosh_wait(BoshPipeline *);
+BOSH_API void bosh_free(BoshPipeline *);
+
+#endif
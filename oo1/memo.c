@@ -0,0 +1,496 @@
+/*
+
+   memo.c
+
+   memo cmd [args] runs cmd the first time and afterwards replays its
+   stdout and exit status from a store on disk instead. Runs are told
+   apart by a 128-bit hash of
+
+     - the words of the command line,
+     - the program PATH resolves cmd to: device, inode, size and
+       modification time, so a rebuilt program runs afresh,
+     - what the command reads: the contents of a < file, or of a pipe
+       into memo, which is read up front into a memfd the command then
+       reads instead. The shell's own stdin is neither read nor hashed.
+
+   The environment, the working directory and files named in the
+   arguments are not part of the key: memo is for commands whose
+   output follows from the above. stderr is not stored, and neither
+   is a run killed by a signal.
+
+   The store is a directory, $BOSH_MEMO or else ~/.cache/bosh/memo:
+   the output of each run in a file named after its key, and an index
+   mapped into memory, an open addressing table from key to exit
+   status and output size. flock on the index lets shells share the
+   store. A hit costs the hash, one probe and a zcopy of the output.
+
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "memo.h"
+#include "builtin.h"
+#include "launch.h"
+#include "jobs.h"
+#include "pipes.h"
+#include "pathhash.h"
+#include "zcopy.h"
+#include "fanout.h"
+
+/* --- symbolic constants --- */
+#define MEMOMAGIC "boshmemo"
+#define MEMOVERSION 1
+#define MEMOSLOTS 1024  /* first size of the index; doubles at 3/4 full */
+#define MEMOCHUNK 65536
+
+#define P1 0x9e3779b97f4a7c15ULL
+#define P2 0xc2b2ae3d27d4eb4fULL
+
+typedef struct _memohash {
+    uint64_t a, b;
+    unsigned char tail[8]; /* bytes short of a whole word */
+    size_t ntail;
+    uint64_t len;
+} MemoHash;
+
+typedef struct _memoentry {
+    uint64_t key[2];
+    uint32_t used;
+    int32_t status;
+    uint64_t size;      /* bytes of output */
+} MemoEntry;
+
+typedef struct _memoindex {
+    char magic[8];
+    uint32_t version;
+    uint32_t nslots;    /* a power of two */
+    uint32_t used;
+    uint32_t pad;
+    MemoEntry slots[];
+} MemoIndex;
+
+static uint64_t rotl(uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t fmix(uint64_t x)
+{
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  return x ^ (x >> 33);
+}
+
+/* --- two lanes, one word at a time --- */
+static void mixword(MemoHash *h, uint64_t w)
+{
+  h->a = rotl(h->a ^ w * P2, 31) * P1;
+  h->b = (rotl(h->b ^ w, 29) + h->a) * P2;
+}
+
+static void hash_add(MemoHash *h, const void *p, size_t n)
+{
+  const unsigned char *s = p;
+  uint64_t w;
+
+  h->len += n;
+  while (h->ntail > 0 && h->ntail < 8 && n > 0) {
+    h->tail[h->ntail++] = *s++;
+    n--;
+  }
+  if (h->ntail == 8) {
+    memcpy(&w, h->tail, 8);
+    mixword(h, w);
+    h->ntail = 0;
+  }
+  for (; n >= 8; s += 8, n -= 8) {
+    memcpy(&w, s, 8);
+    mixword(h, w);
+  }
+  memcpy(h->tail, s, n);
+  h->ntail += n;
+}
+
+static void hash_end(MemoHash *h, uint64_t key[2])
+{
+  uint64_t w = 0;
+
+  memcpy(&w, h->tail, h->ntail);
+  mixword(h, w);
+  mixword(h, h->len);
+  key[0] = fmix(h->a ^ rotl(h->b, 17));
+  key[1] = fmix(h->b + h->a);
+}
+
+/* --- the store: $BOSH_MEMO, or under $XDG_CACHE_HOME or ~/.cache --- */
+static char *memodir(void)
+{
+  static char dir[PATH_MAX];
+  char *s;
+
+  if ((s = getenv("BOSH_MEMO")) != NULL && *s != '\0')
+    snprintf(dir, sizeof(dir), "%s", s);
+  else if ((s = getenv("XDG_CACHE_HOME")) != NULL && *s != '\0')
+    snprintf(dir, sizeof(dir), "%s/bosh/memo", s);
+  else if ((s = getenv("HOME")) != NULL)
+    snprintf(dir, sizeof(dir), "%s/.cache/bosh/memo", s);
+  else
+    return NULL;
+  return dir;
+}
+
+/* --- mkdir -p --- */
+static int mkdirs(char *path)
+{
+  char *s;
+
+  for (s = path + 1; (s = strchr(s, '/')) != NULL; s++) {
+    *s = '\0';
+    if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+      *s = '/';
+      return -1;
+    }
+    *s = '/';
+  }
+  return mkdir(path, 0755) < 0 && errno != EEXIST ? -1 : 0;
+}
+
+static size_t indexlen(uint32_t nslots)
+{
+  return sizeof(MemoIndex) + (size_t) nslots * sizeof(MemoEntry);
+}
+
+static int indexok(MemoIndex *ix, size_t len)
+{
+  return len >= sizeof(MemoIndex) && memcmp(ix->magic, MEMOMAGIC, 8) == 0 &&
+         ix->version == MEMOVERSION && ix->nslots > 0 &&
+         (ix->nslots & (ix->nslots - 1)) == 0 && len == indexlen(ix->nslots);
+}
+
+/* --- the slot holding key, or the empty one it would go in --- */
+static MemoEntry *probe(MemoIndex *ix, uint64_t key[2])
+{
+  uint32_t mask = ix->nslots - 1, i = key[0] & mask;
+  MemoEntry *e;
+
+  for (;; i = (i + 1) & mask) { // Never full: it grows first
+    e = &ix->slots[i];
+    if (!e->used || (e->key[0] == key[0] && e->key[1] == key[1]))
+      return e;
+  }
+}
+
+/* --- open dir's index, locked with how --- */
+static int openindex(char *dir, int how)
+{
+  char name[PATH_MAX];
+  int fd;
+
+  if (snprintf(name, sizeof(name), "%s/index", dir) >= (int) sizeof(name)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  if ((fd = open(name, O_RDWR|O_CREAT|O_CLOEXEC, 0644)) < 0)
+    return -1;
+  while (flock(fd, how) < 0)
+    if (errno != EINTR) {
+      close(fd);
+      return -1;
+    }
+  return fd;
+}
+
+/* --- lookup: copy key's entry to *e; 1 if there is one --- */
+static int lookup(char *dir, uint64_t key[2], MemoEntry *e)
+{
+  struct stat sb;
+  MemoIndex *ix;
+  int fd, found = 0;
+
+  if ((fd = openindex(dir, LOCK_SH)) < 0)
+    return 0;
+  if (fstat(fd, &sb) == 0 && (size_t) sb.st_size >= sizeof(MemoIndex) &&
+      (ix = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0)) != MAP_FAILED) {
+    if (indexok(ix, sb.st_size)) {
+      *e = *probe(ix, key);
+      found = e->used;
+    }
+    munmap(ix, sb.st_size);
+  }
+  close(fd);
+  return found;
+}
+
+/* --- size the index file for nslots empty slots and map it --- */
+static MemoIndex *newindex(int fd, uint32_t nslots)
+{
+  MemoIndex *ix;
+
+  if (ftruncate(fd, indexlen(nslots)) < 0)
+    return NULL;
+  ix = mmap(NULL, indexlen(nslots), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if (ix == MAP_FAILED)
+    return NULL;
+  memset(ix, 0, indexlen(nslots));
+  memcpy(ix->magic, MEMOMAGIC, 8);
+  ix->version = MEMOVERSION;
+  ix->nslots = nslots;
+  return ix;
+}
+
+/*
+ * store : enter key in dir's index. An index that is missing or not
+ * ours is started over; one that would be more than 3/4 full is
+ * rebuilt at twice the size first.
+ */
+static void store(char *dir, uint64_t key[2], int status, uint64_t size)
+{
+  struct stat sb;
+  MemoIndex *ix = NULL;
+  MemoEntry *e, *old = NULL;
+  uint32_t i, n = 0, nslots = MEMOSLOTS;
+  int fd;
+
+  if ((fd = openindex(dir, LOCK_EX)) < 0)
+    return;
+  if (fstat(fd, &sb) == 0 && (size_t) sb.st_size >= sizeof(MemoIndex)) {
+    ix = mmap(NULL, sb.st_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ix == MAP_FAILED)
+      ix = NULL;
+    else if (!indexok(ix, sb.st_size)) {
+      munmap(ix, sb.st_size);
+      ix = NULL;
+    }
+  }
+
+  if (ix != NULL && (ix->used + 1) * 4 > ix->nslots * 3) { // Keep what is there
+    nslots = ix->nslots * 2;
+    if ((old = malloc(ix->used * sizeof(MemoEntry))) != NULL)
+      for (i = 0; i < ix->nslots; i++)
+        if (ix->slots[i].used)
+          old[n++] = ix->slots[i];
+    munmap(ix, sb.st_size);
+    ix = NULL;
+  }
+  if (ix == NULL) {
+    if ((ix = newindex(fd, nslots)) == NULL) {
+      free(old);
+      close(fd);
+      return;
+    }
+    for (i = 0; i < n; i++) {
+      *probe(ix, old[i].key) = old[i];
+      ix->used++;
+    }
+    free(old);
+  }
+
+  e = probe(ix, key);
+  if (!e->used)
+    ix->used++;
+  e->key[0] = key[0];
+  e->key[1] = key[1];
+  e->status = status;
+  e->size = size;
+  e->used = 1;
+  munmap(ix, indexlen(ix->nslots));
+  close(fd);
+}
+
+/*
+ * keyinput : add what the command is to read from in to h. Returns the
+ * fd to give the command: in, or a memfd holding everything that came
+ * through a pipe. -1 on error.
+ */
+static int keyinput(MemoHash *h, int in)
+{
+  struct stat sb;
+  char buf[MEMOCHUNK], *p;
+  ssize_t n;
+  int mfd;
+
+  if ((in == 0 && builtin_stdin) || fstat(in, &sb) < 0) // The shell's stdin is not ours to read
+    return in;
+  if (S_ISREG(sb.st_mode)) {
+    hash_add(h, "<", 1);
+    if (sb.st_size == 0)
+      return in;
+    if ((p = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, in, 0)) == MAP_FAILED)
+      return -1;
+    madvise(p, sb.st_size, MADV_SEQUENTIAL);
+    hash_add(h, p, sb.st_size);
+    munmap(p, sb.st_size);
+    return in;
+  }
+  if (!S_ISFIFO(sb.st_mode) && !S_ISSOCK(sb.st_mode)) // A terminal or device
+    return in;
+
+  hash_add(h, "<", 1);
+  if ((mfd = memfd_create("memo", MFD_CLOEXEC)) < 0)
+    return -1;
+  while ((n = read(in, buf, sizeof(buf))) != 0) {
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 || bwrite(mfd, buf, n) < 0) {
+      close(mfd);
+      return -1;
+    }
+    hash_add(h, buf, n);
+  }
+  lseek(mfd, 0, SEEK_SET);
+  return mfd;
+}
+
+/*
+ * copyout : copy the command's output from `from` to out and to blob,
+ * up to EOF even if out's reader goes away. Returns 0 once blob has
+ * all of it, -1 if it does not.
+ */
+static int copyout(int from, int out, int blob)
+{
+  int outs[2] = { blob, out };
+  char buf[MEMOCHUNK];
+  struct stat sb;
+  ssize_t n;
+
+  if (blob != -1 && fstat(out, &sb) == 0 && S_ISFIFO(sb.st_mode)) {
+    if (fanout(from, outs, 2) >= 0) // Both copies by reference
+      return 0;
+    blob = -1; // The rest still goes to out
+  }
+  while ((n = read(from, buf, sizeof(buf))) != 0) {
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return -1;
+    if (out != -1 && bwrite(out, buf, n) < 0)
+      out = -1;
+    if (blob != -1 && bwrite(blob, buf, n) < 0)
+      blob = -1;
+  }
+  return blob == -1 ? -1 : 0;
+}
+
+/*
+ * run : run argv reading in, its output copied to out and to blob
+ * (-1: nowhere). *keep is set when blob got a complete run worth
+ * storing. Returns the exit status.
+ */
+static int run(char **argv, int in, int out, int blob, int *keep)
+{
+  int fd[2], status, copied;
+  Job *job;
+  pid_t pid;
+
+  *keep = 0;
+  if (mkpipe(fd, pipe_size) < 0) {
+    fprintf(stderr, "memo: %s\n", strerror(errno));
+    return 1;
+  }
+  job = job_new(1, argv[0], 0);
+  job_stagestart(job, 0, argv[0]);
+  pid = spawncmd(argv, in == 0 && builtin_stdin ? -1 : in, fd[1], NULL, NULL);
+  job_setpid(job, 0, pid);
+  close(fd[1]);
+
+  copied = copyout(fd[0], out, blob);
+  close(fd[0]);
+  status = job_wait(job);
+  *keep = blob != -1 && pid > 0 && copied == 0 && !WIFSIGNALED(job->stages[0].status);
+  job_free(job);
+  return status;
+}
+
+/*
+ * memo : replay the stored output and status of argv for what in
+ * holds, or run it and store them. Returns the exit status.
+ */
+int memo(char **argv, int in, int out)
+{
+  char *path, *dir, name[PATH_MAX], tmp[PATH_MAX];
+  uint64_t key[2], id[5];
+  MemoHash h = { P1, P2 };
+  MemoEntry e;
+  struct stat sb;
+  int cmdin, fd, status, keep, blob = -1;
+  char **w;
+
+  if ((path = path_lookup(argv[0])) == NULL || stat(path, &sb) < 0) {
+    fprintf(stderr, "%s: command not found\n", argv[0]);
+    return 127;
+  }
+  id[0] = sb.st_dev;
+  id[1] = sb.st_ino;
+  id[2] = sb.st_size;
+  id[3] = sb.st_mtim.tv_sec;
+  id[4] = sb.st_mtim.tv_nsec;
+  hash_add(&h, id, sizeof(id));
+  hash_add(&h, path, strlen(path) + 1);
+  for (w = argv; *w != NULL; w++)
+    hash_add(&h, *w, strlen(*w) + 1);
+  hash_add(&h, "", 1); // End of the words
+  if ((cmdin = keyinput(&h, in)) < 0) {
+    fprintf(stderr, "memo: input: %s\n", strerror(errno));
+    return 1;
+  }
+  hash_end(&h, key);
+
+  // Every name in the store must fit, or the store is not used: a
+  // $BOSH_MEMO cut short would be some other directory
+  dir = memodir();
+  if (dir != NULL &&
+      (snprintf(name, sizeof(name), "%s/%016llx%016llx", dir, (unsigned long long) key[0],
+                (unsigned long long) key[1]) >= (int) sizeof(name) ||
+       snprintf(tmp, sizeof(tmp), "%s/.new.XXXXXX", dir) >= (int) sizeof(tmp))) {
+    fprintf(stderr, "memo: store path too long, running %s\n", argv[0]);
+    status = run(argv, cmdin, out, -1, &keep);
+    goto out;
+  }
+  if (dir == NULL || mkdirs(dir) < 0) {
+    fprintf(stderr, "memo: no store%s%s, running %s\n",
+            dir ? ": " : "", dir ? strerror(errno) : "", argv[0]);
+    status = run(argv, cmdin, out, -1, &keep);
+    goto out;
+  }
+
+  if (lookup(dir, key, &e) && (fd = open(name, O_RDONLY|O_CLOEXEC)) >= 0) {
+    if (fstat(fd, &sb) == 0 && (uint64_t) sb.st_size == e.size) { // Replay
+      if (zcopy(fd, out, NULL) < 0 && errno != EPIPE)
+        fprintf(stderr, "memo: %s\n", strerror(errno));
+      close(fd);
+      status = e.status;
+      goto out;
+    }
+    close(fd); // Output gone or changed: run again
+  }
+
+  if ((blob = mkostemp(tmp, O_CLOEXEC)) < 0)
+    fprintf(stderr, "memo: %s: %s\n", dir, strerror(errno));
+  status = run(argv, cmdin, out, blob, &keep);
+  if (blob != -1) {
+    if (keep && fstat(blob, &sb) == 0 && rename(tmp, name) == 0)
+      store(dir, key, status, sb.st_size);
+    else
+      unlink(tmp);
+    close(blob);
+  }
+
+ out:
+  if (cmdin != in)
+    close(cmdin);
+  return status;
+}
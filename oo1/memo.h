@@ -0,0 +1,15 @@
+/*
+
+   memo.h
+
+   Run a command once per input and replay its stdout and exit status
+   from an on-disk store after that.
+
+ */
+
+#ifndef _MEMO_H
+#define _MEMO_H
+
+int memo(char **, int, int);
+
+#endif
@@ -0,0 +1,296 @@
+/*
+
+   meter.c
+
+   With set -o meter, every pipe between two processes of a pipeline
+   becomes two: the writer fills one, the reader drains the other, and
+   a relay thread in the shell moves the data across with splice(2),
+   page references and no copy through user space. On the way it
+   counts the bytes, and the time each pipe sat empty (the writer was
+   slow: the reader starved) or full (the reader was slow: the writer
+   was held up). One relay thread serves all pipes of a pipeline.
+
+   pstat lists running metered pipelines and the last one to finish;
+   set -o meter=SECS also has the relay report on stderr every SECS
+   seconds and when the pipeline ends. Counters are read without
+   locking, so a report may be a splice behind.
+
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "meter.h"
+#include "pipes.h"
+
+/* --- symbolic constants --- */
+#define RELAYCHUNK (1 << 20)  /* most bytes per splice */
+#define LINKNAME 40
+
+int meter_on = 0;
+int meter_every = 0;
+
+/* --- running meters, and the one that finished last --- */
+static pthread_mutex_t meterlock = PTHREAD_MUTEX_INITIALIZER;
+static Meter *meters, *lastmeter;
+
+static double seconds(struct timespec a, struct timespec b)
+{
+  return (b.tv_sec - a.tv_sec) + (b.tv_nsec - a.tv_nsec) / 1e9;
+}
+
+/* --- meter_new: a meter for cmdline, with room for nlinks pipes --- */
+Meter *meter_new(char *cmdline, int nlinks)
+{
+  Meter *m = calloc(1, sizeof(Meter));
+
+  if (m == NULL)
+    return NULL;
+  if ((m->links = calloc(nlinks, sizeof(MeterLink))) == NULL) {
+    free(m);
+    return NULL;
+  }
+  m->cap = nlinks;
+  m->cmdline = strdup(cmdline);
+  return m;
+}
+
+static void meter_free(Meter *m)
+{
+  int i;
+
+  for (i = 0; i < m->nlinks; i++) {
+    free(m->links[i].writer);
+    free(m->links[i].reader);
+  }
+  free(m->links);
+  free(m->cmdline);
+  free(m);
+}
+
+/*
+ * meter_pipe : like mkpipe, for a pipe from stage writer to stage
+ * reader, but with the relay in between: fd[1] is for the writer,
+ * fd[0] for the reader. Returns 0 or -1.
+ */
+int meter_pipe(Meter *m, int fd[2], long size, char *writer, char *reader)
+{
+  int a[2], b[2];
+  MeterLink *l;
+
+  if (m->nlinks == m->cap) {
+    errno = ENOSPC;
+    return -1;
+  }
+  if (mkpipe(a, size) < 0)
+    return -1;
+  if (mkpipe(b, size) < 0) {
+    close(a[0]);
+    close(a[1]);
+    return -1;
+  }
+  l = &m->links[m->nlinks++];
+  l->from = a[0];
+  l->to = b[1];
+  l->writer = strdup(writer);
+  l->reader = strdup(reader);
+  fd[0] = b[0];
+  fd[1] = a[1];
+  return 0;
+}
+
+/* --- one line per pipe, in pipeline order; rates since the last snapshot if snap --- */
+static void report(Meter *m, int fd, int snap)
+{
+  struct timespec now;
+  double total, interval;
+  char name[LINKNAME];
+  int i;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (!m->running)
+    now = m->end;
+  total = seconds(m->start, now);
+  interval = seconds(m->snap, now);
+  dprintf(fd, "%s%s\n", m->cmdline, m->running ? "" : " (done)");
+  for (i = m->nlinks - 1; i >= 0; i--) {
+    MeterLink *l = &m->links[i];
+    unsigned long bytes = snap ? l->bytes - l->snapbytes : l->bytes;
+    double t = snap ? interval : total;
+    snprintf(name, sizeof(name), "%s -> %s", l->writer, l->reader);
+    dprintf(fd, "  %-24s %14lu bytes %9.1f MiB/s  empty %3.0f%%  full %3.0f%%\n",
+            name, l->bytes, t > 0 ? bytes / t / (1 << 20) : 0.0,
+            total > 0 ? 100 * l->inwait / total : 0.0,
+            total > 0 ? 100 * l->outwait / total : 0.0);
+    if (snap)
+      l->snapbytes = l->bytes;
+  }
+  if (snap)
+    m->snap = now;
+}
+
+/* --- move what is in l's first pipe to its second, until that would block --- */
+static void pump(MeterLink *l)
+{
+  ssize_t n;
+  int avail;
+
+  for (;;) {
+    n = splice(l->from, NULL, l->to, NULL, RELAYCHUNK, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+    if (n > 0) {
+      l->bytes += n;
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno == EAGAIN) { // Data left over: the reader's pipe is full
+      l->full = ioctl(l->from, FIONREAD, &avail) == 0 && avail > 0;
+      return;
+    }
+    // The writer is done, or the reader is gone: pass that on
+    close(l->from);
+    close(l->to);
+    l->done = 1;
+    return;
+  }
+}
+
+/* --- take m off the running list; it is the last one to finish now --- */
+static void retire(Meter *m)
+{
+  Meter **p;
+
+  pthread_mutex_lock(&meterlock);
+  for (p = &meters; *p != NULL; p = &(*p)->next)
+    if (*p == m) {
+      *p = m->next;
+      break;
+    }
+  if (lastmeter != NULL)
+    meter_free(lastmeter);
+  lastmeter = m;
+  pthread_mutex_unlock(&meterlock);
+}
+
+static void *relay(void *arg)
+{
+  Meter *m = arg;
+  struct pollfd pfd[m->nlinks];
+  MeterLink *ls[m->nlinks];
+  struct timespec now;
+  int i, n, live = m->nlinks, timeout;
+
+  while (live > 0) {
+    for (i = 0, n = 0; i < m->nlinks; i++) {
+      MeterLink *l = &m->links[i];
+      if (l->done)
+        continue;
+      pfd[n].fd = l->full ? l->to : l->from;
+      pfd[n].events = l->full ? POLLOUT : POLLIN;
+      ls[n++] = l;
+    }
+    timeout = -1;
+    if (meter_every > 0) {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      timeout = (meter_every - seconds(m->snap, now)) * 1000;
+      if (timeout <= 0) {
+        report(m, 2, 1);
+        timeout = meter_every * 1000;
+      }
+    }
+    if (poll(pfd, n, timeout) <= 0)
+      continue;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (i = 0; i < n; i++) {
+      MeterLink *l = ls[i];
+      if (pfd[i].revents == 0)
+        continue;
+      if (l->full) // Time since the last pump was spent waiting
+        l->outwait += seconds(l->since, now);
+      else
+        l->inwait += seconds(l->since, now);
+      pump(l);
+      clock_gettime(CLOCK_MONOTONIC, &l->since);
+      live -= l->done;
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &m->end);
+  m->running = 0;
+  if (meter_every > 0)
+    report(m, 2, 0);
+  if (m->detached)
+    retire(m);
+  return NULL;
+}
+
+/*
+ * meter_start : start the relay for the pipes of m. A detached meter
+ * (background pipelines) retires by itself; otherwise call meter_join
+ * once the pipeline has ended. Returns -1 if there is nothing to join:
+ * m had no pipes, or no relay could be started and its pipes are
+ * closed, so the stages see EOF and EPIPE.
+ */
+int meter_start(Meter *m, int detached)
+{
+  int i;
+
+  if (m->nlinks == 0) {
+    meter_free(m);
+    return -1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &m->start);
+  m->snap = m->start;
+  for (i = 0; i < m->nlinks; i++)
+    m->links[i].since = m->start;
+  m->running = 1;
+  m->detached = detached;
+
+  pthread_mutex_lock(&meterlock);
+  m->next = meters;
+  meters = m;
+  pthread_mutex_unlock(&meterlock);
+  if (pthread_create(&m->tid, NULL, relay, m) != 0) {
+    fprintf(stderr, "meter: cannot start the relay\n");
+    for (i = 0; i < m->nlinks; i++) {
+      close(m->links[i].from);
+      close(m->links[i].to);
+    }
+    m->running = 0;
+    m->end = m->start;
+    retire(m);
+    return -1;
+  }
+  if (detached)
+    pthread_detach(m->tid);
+  return 0;
+}
+
+/* --- meter_join: wait for the relay of a meter started attached --- */
+void meter_join(Meter *m)
+{
+  pthread_join(m->tid, NULL);
+  retire(m);
+}
+
+/* --- meter_report: pstat, the running meters and the last finished --- */
+int meter_report(int fd)
+{
+  Meter *m;
+
+  pthread_mutex_lock(&meterlock);
+  for (m = meters; m != NULL; m = m->next)
+    report(m, fd, 0);
+  if (lastmeter != NULL)
+    report(lastmeter, fd, 0);
+  pthread_mutex_unlock(&meterlock);
+  return 0;
+}
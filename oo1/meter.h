@@ -0,0 +1,47 @@
+/*
+
+   meter.h
+
+   Throughput meter: a splice relay in each pipe of a pipeline,
+   counting bytes and the time each pipe's writer or reader held the
+   others up.
+
+ */
+
+#ifndef _METER_H
+#define _METER_H
+
+#include <time.h>
+#include <pthread.h>
+
+typedef struct _meterlink {
+    int from, to;          /* relay's ends: the writer's pipe, the reader's pipe */
+    char *writer, *reader; /* argv[0] of the stages on either side */
+    int full;              /* waiting for room in to, else for data in from */
+    int done;
+    unsigned long bytes, snapbytes;
+    double inwait, outwait; /* seconds spent waiting for the writer, the reader */
+    struct timespec since;
+} MeterLink;
+
+typedef struct _meter {
+    struct _meter *next;   /* running meters */
+    pthread_t tid;
+    int detached;
+    int running;
+    char *cmdline;
+    int nlinks, cap;
+    MeterLink *links;      /* last pipe of the pipeline first */
+    struct timespec start, end, snap;
+} Meter;
+
+extern int meter_on;    /* set -o meter */
+extern int meter_every; /* seconds between reports on stderr; 0: none */
+
+Meter *meter_new(char *, int);
+int meter_pipe(Meter *, int [2], long, char *, char *);
+int meter_start(Meter *, int);
+void meter_join(Meter *);
+int meter_report(int);
+
+#endif
@@ -1,12 +1,11 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <ctype.h>
 #include "parser.h"
 
 /* --- symbolic constants --- */
-#define COMMANDMAX 20
-#define BUFFERMAX 256
-#define PBUFFERMAX 50
 #define PIPE  ('|')
 #define BG    ('&')
 #define RIN   ('<')
@@ -20,40 +19,43 @@
 #define isrut(c)  ((c) == RUT)
 #define isspec(c) (ispipe(c) || isbg(c) || isrin(c) || isrut(c))
 
-/* --- static memory allocation --- */
-static Cmd  cmdbuf[COMMANDMAX], *cmds;
-static char cbuf[BUFFERMAX], *cp;
-static char *pbuf[PBUFFERMAX], **pp;
-
 /*
  * parse : A simple commandline parser.
+ *
+ * Tokens, argument vectors and Cmd nodes are carved out of the
+ * Shellcmd's own arena, so lines of any length and any number of
+ * pipe-components parse without per-token malloc, and several
+ * Shellcmds can be alive at once.
  */
 
+static int heredoc(Arena *, char *, Shellcmd *);
+
 /* --- parse the commandline and build shell commmand structure --- */
-int parsecommand(char *cmdline, Shellcmd *shellcmd)
+static int parsetokens(char *cmdline, Shellcmd *shellcmd)
 {
-  int i, n;
+  int n;
   Cmd *cmd0;
+  Arena *a = &shellcmd->arena;
 
   char *t = cmdline;
   char *tok;
 
-  // Initialize list
-  for (i = 0; i < COMMANDMAX-1; i++) cmdbuf[i].next = &cmdbuf[i+1];
-    
-  cmdbuf[COMMANDMAX-1].next = NULL;
-  cmds = cmdbuf;
-  cp = cbuf;
-  pp = pbuf;
+  // Storage of the previous line is reused
+  arena_reset(a);
 
   shellcmd->rd_stdin    = NULL;
   shellcmd->rd_stdout   = NULL;
   shellcmd->rd_stderr   = NULL;
+  shellcmd->rd_here     = NULL;
+  shellcmd->rd_herelen  = 0;
+  shellcmd->rd_heredelim = NULL;
+  shellcmd->herelen     = 0;
   shellcmd->background = 0; // false 
   shellcmd->the_cmds       = NULL;
+  shellcmd->text        = NULL;
 
   do {
-    if ((n = acmd(t, &cmd0)) <= 0)
+    if ((n = acmd(a, t, &cmd0)) <= 0)
       return -1;
     t += n;
 
@@ -62,7 +64,7 @@ int parsecommand(char *cmdline, Shellcmd *shellcmd)
 
     int newtoken = 1;
     while (newtoken) {
-      n = nexttoken(t, &tok);
+      n = nexttoken(a, t, &tok);
       if (n == 0)
     	{
     	  return 1;
@@ -76,7 +78,7 @@ int parsecommand(char *cmdline, Shellcmd *shellcmd)
         	break;
         
         case BG:
-        	n = nexttoken(t, &tok);
+        	n = nexttoken(a, t, &tok);
         	if (n == 0)
         	  {
         	    shellcmd->background = 1;
@@ -91,13 +93,24 @@ int parsecommand(char *cmdline, Shellcmd *shellcmd)
         	break;
 
         case RIN:
-        	if (shellcmd->rd_stdin != NULL)
+        	if (shellcmd->rd_stdin != NULL || shellcmd->rd_here != NULL ||
+        	    shellcmd->rd_heredelim != NULL)
         	  {
         	    fprintf(stderr, "duplicate redirection of stdin\n");
         	    return -1;
         	  }
-        	if ((n = nexttoken(t, &(shellcmd->rd_stdin))) < 0) 
-        	  return -1;
+        	if (isrin(*t)) // << or <<<
+        	  {
+        	    if ((n = heredoc(a, t, shellcmd)) <= 0)
+        	      return -1;
+        	    t += n;
+        	    break;
+        	  }
+        	if ((n = nexttoken(a, t, &(shellcmd->rd_stdin))) <= 0)
+        	  {
+        	    fprintf(stderr, "missing filename for redirection\n");
+        	    return -1;
+        	  }
         	if (!isidentifier(shellcmd->rd_stdin))
         	  {
         	    fprintf(stderr, "Illegal filename: \"%s\"\n", shellcmd->rd_stdin);
@@ -112,8 +125,11 @@ int parsecommand(char *cmdline, Shellcmd *shellcmd)
         	    fprintf(stderr, "duplicate redirection of stdout\n");
         	    return -1;
         	  }
-        	if ((n = nexttoken(t, &(shellcmd->rd_stdout))) < 0) 
-        	  return -1;
+        	if ((n = nexttoken(a, t, &(shellcmd->rd_stdout))) <= 0)
+        	  {
+        	    fprintf(stderr, "missing filename for redirection\n");
+        	    return -1;
+        	  }
         	if (!isidentifier(shellcmd->rd_stdout))
         	  {
         	    fprintf(stderr, "Illegal filename: \"%s\"\n", shellcmd->rd_stdout);
@@ -130,48 +146,153 @@ int parsecommand(char *cmdline, Shellcmd *shellcmd)
   return 0;
 }
 
-int nexttoken( char *s, char **tok)
+/*
+ * parsecommand : parse cmdline into shellcmd. Returns 1, or -1 after
+ * an error, leaving nothing to run and no << body to wait for.
+ */
+int parsecommand(char *cmdline, Shellcmd *shellcmd)
+{
+  int n = parsetokens(cmdline, shellcmd);
+
+  if (n <= 0)
+    {
+      shellcmd->the_cmds = NULL;
+      shellcmd->rd_heredelim = NULL;
+      shellcmd->rd_here = NULL;
+      shellcmd->rd_herelen = 0;
+    }
+  return n;
+}
+
+/*
+ * heredoc : after a <, s starts with "<WORD" or "<<word". <<WORD takes
+ * the lines up to WORD, which heredocline collects, as stdin; <<<word
+ * takes word and a newline. Returns the characters used, or -1.
+ */
+static int heredoc(Arena *a, char *s, Shellcmd *shellcmd)
+{
+  int here = isrin(s[1]), n;
+  char *word;
+
+  s += 1 + here;
+  if ((n = nexttoken(a, s, &word)) <= 0 || isspec(*word))
+    {
+      fprintf(stderr, "missing %s\n", here ? "word after <<<" : "delimiter after <<");
+      return -1;
+    }
+  if (here)
+    {
+      shellcmd->rd_herelen = strlen(word) + 1;
+      shellcmd->rd_here = arena_alloc(a, shellcmd->rd_herelen + 1);
+      stpcpy(stpcpy(shellcmd->rd_here, word), "\n");
+    }
+  else
+    shellcmd->rd_heredelim = word;
+  return 1 + here + n;
+}
+
+/*
+ * heredocline : one more line for a pending << body. Returns 1 when
+ * line was the delimiter and the body is complete, 0 otherwise, and
+ * -1 if the body could not be stored: the command is then dropped.
+ */
+int heredocline(Shellcmd *shellcmd, char *line)
+{
+  size_t len = strlen(line), cap;
+  char *buf;
+
+  if (strcmp(line, shellcmd->rd_heredelim) == 0)
+    {
+      shellcmd->rd_here = shellcmd->herebuf != NULL ? shellcmd->herebuf : "";
+      shellcmd->rd_herelen = shellcmd->herelen;
+      return 1;
+    }
+  if (shellcmd->herelen + len + 1 > shellcmd->herecap)
+    {
+      for (cap = shellcmd->herecap; shellcmd->herelen + len + 1 > cap; )
+        cap = cap ? cap * 2 : 4096;
+      if ((buf = realloc(shellcmd->herebuf, cap)) == NULL)
+        {
+          fprintf(stderr, "here-document: %s\n", strerror(errno));
+          shellcmd->the_cmds = NULL;
+          shellcmd->rd_heredelim = NULL;
+          return -1;
+        }
+      shellcmd->herebuf = buf;
+      shellcmd->herecap = cap;
+    }
+  memcpy(shellcmd->herebuf + shellcmd->herelen, line, len);
+  shellcmd->herelen += len;
+  shellcmd->herebuf[shellcmd->herelen++] = '\n';
+  return 0;
+}
+
+/* --- past the ) that closes the $( at s, or to the end of s --- */
+static char *substskip(char *s)
+{
+  int depth = 0;
+
+  for (s++; *s != '\0'; s++) {
+    if (*s == '(')
+      depth++;
+    else if (*s == ')' && --depth == 0)
+      return s + 1;
+  }
+  return s;
+}
+
+/* --- find the next token in s: sets *start and returns its end --- */
+static char *scantoken(char *s, char **start)
 {
-  char *s0 = s;
   char c;
 
-  *tok = cp;
-  while (isspace(c = *s++) && c);
+  while (isspace(c = *s) && c) s++;
+  *start = s;
   if (c == '\0') // Is c end-of-string?
-  {
-    *cp++ = '\0'; // End cp with end-of-string
-    return 0;
-  }
+    return s;
   if (isspec(c)) // Is c special?
+    return s + 1;
+  do {
+    if (c == '$' && s[1] == '(') // $(...) is part of the word, blanks and all
+      s = substskip(s);
+    else
+      s++;
+    c = *s;
+  } while (!isspace(c) && !isspec(c) && (c != '\0'));
+  return s;
+}
+
+int nexttoken(Arena *a, char *s, char **tok)
+{
+  char *start;
+  char *end = scantoken(s, &start);
+
+  if (end == start) // End of string: empty token
   {
-    *cp++ = c; // Add c
-    *cp++ = '\0'; // End cp with end-of-string
-  }
-  else
-  {
-    *cp++ = c;
-    do
-  	{
-  	  c = *cp++ = *s++;
-  	} while (!isspace(c) && !isspec(c) && (c != '\0'));
-    --s;
-    --cp;
-    *cp++ = '\0';
+    *tok = "";
+    return 0;
   }
-  return s - s0;
+  *tok = arena_strndup(a, start, end - start);
+  return end - s;
 }
 
-int acmd (char *s, Cmd **cmd) // 
+int acmd (Arena *a, char *s, Cmd **cmd)
 {
-  char *tok;
-  int n, cnt = 0;
-  Cmd *cmd0 = cmds;
-  cmds = cmds->next;
+  char *tok, *start, *end;
+  int n, cnt = 0, argc = 0;
+  Cmd *cmd0 = arena_alloc(a, sizeof(Cmd));
+  char **pp;
+
+  // Count the words first so the argument vector is one block
+  for (end = s; (end = scantoken(end, &start)) != start && !isspec(*start); )
+    argc++;
+  pp = arena_alloc(a, (argc + 1) * sizeof(char *));
+
   cmd0->next = NULL;
   cmd0->cmd = pp;
 
   while (1) {
-    n = nexttoken(s, &tok);
+    n = nexttoken(a, s, &tok);
     if (n == 0 || isspec(*tok))
     {
     	*cmd = cmd0;
@@ -187,6 +308,73 @@ int acmd (char *s, Cmd **cmd) //
   }
 }
 
+/* --- append s and a separator to p --- */
+static char *textcat(char *p, char *sep, char *s)
+{
+  p = stpcpy(p, sep);
+  return stpcpy(p, s);
+}
+
+/* --- shellcmdtext: the command as text, in the Shellcmd's arena --- */
+char *shellcmdtext(Shellcmd *shellcmd)
+{
+  Cmd *c;
+  char **argv, *text, *p;
+  size_t len = 8;
+  int n = 0, i;
+
+  if (shellcmd->text != NULL) // Made once per parse, however often it runs
+    return shellcmd->text;
+
+  for (c = shellcmd->the_cmds; c != NULL; c = c->next, n++)
+    for (argv = c->cmd; *argv != NULL; argv++)
+      len += strlen(*argv) + 3;
+  if (shellcmd->rd_stdin != NULL)
+    len += strlen(shellcmd->rd_stdin) + 3;
+  if (shellcmd->rd_stdout != NULL)
+    len += strlen(shellcmd->rd_stdout) + 3;
+  if (shellcmd->rd_heredelim != NULL)
+    len += strlen(shellcmd->rd_heredelim) + 4;
+  else if (shellcmd->rd_here != NULL)
+    len += shellcmd->rd_herelen + 5;
+
+  // Components are listed last to first
+  Cmd *cmds[n];
+  for (c = shellcmd->the_cmds, i = n; c != NULL; c = c->next)
+    cmds[--i] = c;
+
+  p = text = arena_alloc(&shellcmd->arena, len);
+  *p = '\0';
+  for (i = 0; i < n; i++) {
+    for (argv = cmds[i]->cmd; *argv != NULL; argv++)
+      p = textcat(p, argv == cmds[i]->cmd ? (i ? " | " : "") : " ", *argv);
+    if (i == 0 && shellcmd->rd_stdin != NULL)
+      p = textcat(p, " < ", shellcmd->rd_stdin);
+    if (i == 0 && shellcmd->rd_heredelim != NULL)
+      p = textcat(p, " << ", shellcmd->rd_heredelim);
+    else if (i == 0 && shellcmd->rd_here != NULL) {
+      p = textcat(p, " <<< ", shellcmd->rd_here);
+      *--p = '\0'; // Without the newline
+    }
+  }
+  if (shellcmd->rd_stdout != NULL)
+    p = textcat(p, " > ", shellcmd->rd_stdout);
+  if (shellcmd->background)
+    p = stpcpy(p, " &");
+  return shellcmd->text = text;
+}
+
+/* --- release the arena behind a Shellcmd --- */
+void freeshellcmd(Shellcmd *shellcmd)
+{
+  arena_free(&shellcmd->arena);
+  free(shellcmd->herebuf);
+  shellcmd->herebuf = NULL;
+  shellcmd->herecap = 0;
+  shellcmd->the_cmds = NULL;
+  shellcmd->text = NULL;
+}
+
 int isidentifier (char *s)
 {
   while (*s)
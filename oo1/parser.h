@@ -1,18 +1,41 @@
+#ifndef _PARSER_H
+#define _PARSER_H
+
+#include "arena.h"
+
 typedef struct _cmd {
     char **cmd;
     struct _cmd *next;
 } Cmd;
 
+/* all strings and Cmd nodes live in arena; a zeroed Shellcmd is ready
+   for parsecommand, which reuses the arena of the previous line */
 typedef struct _shellcmd { 
     Cmd  *the_cmds;
     char *rd_stdin;
     char *rd_stdout;
     char *rd_stderr;
+    char *rd_here;      /* stdin contents from <<< word or a << body */
+    size_t rd_herelen;
+    char *rd_heredelim; /* << delimiter; rd_here is NULL until its line */
     int background;
+    Arena arena;
+    char *herebuf;      /* << body read so far (malloc, kept for reuse) */
+    size_t herelen, herecap;
+    char *text;         /* shellcmdtext, once asked for */
 } Shellcmd;
 
+/* waiting for the rest of a << body? */
+#define heredocpending(s) ((s)->rd_heredelim != NULL && (s)->rd_here == NULL)
+
 extern void init( void );
 extern int parse ( char *, Shellcmd *);
-extern int nexttoken( char *, char **);
-extern int acmd( char *, Cmd **);
+extern int parsecommand( char *, Shellcmd *);
+extern void freeshellcmd( Shellcmd *);
+extern char *shellcmdtext( Shellcmd *);
+extern int nexttoken( Arena *, char *, char **);
+extern int acmd( Arena *, char *, Cmd **);
 extern int isidentifier( char * );
+extern int heredocline( Shellcmd *, char * );
+
+#endif
@@ -0,0 +1,212 @@
+/*
+
+   pathhash.c
+
+   Chained hash table from command name to the file PATH resolves it
+   to. Misses are cached as well: the mtimes of the PATH directories
+   are remembered, and a negative entry only stays valid while none of
+   those directories has changed since it was looked up. The whole table
+   is dropped when PATH itself changes. Positive entries are trusted
+   until an exec of the cached file fails, see path_forget.
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "pathhash.h"
+
+/* --- symbolic constants --- */
+#define BUCKETS 256 /* power of two */
+
+typedef struct _pathentry {
+    char *name;
+    char *path;     /* NULL: not found anywhere in PATH */
+    unsigned gen;   /* dirgen when a miss was looked up */
+    unsigned hits;
+    struct _pathentry *next;
+} PathEntry;
+
+static PathEntry *buckets[BUCKETS];
+static char *cachedpath;      /* value of PATH the table was built for */
+
+/* --- PATH directories, their last seen mtimes and a change counter --- */
+static char **dirs;
+static struct timespec *dirtimes;
+static int ndirs;
+static unsigned dirgen;
+
+static unsigned strhash(const char *s)
+{
+  unsigned h = 2166136261u; // FNV-1a
+  while (*s)
+    h = (h ^ (unsigned char) *s++) * 16777619u;
+  return h;
+}
+
+/* --- split PATH into dirs[]; an empty component means "." --- */
+static void splitpath(char *path)
+{
+  char *p, *colon;
+  int n = 1;
+
+  for (p = path; *p; p++)
+    if (*p == ':')
+      n++;
+  dirs = malloc(n * sizeof(char *));
+  dirtimes = calloc(n, sizeof(struct timespec));
+  for (ndirs = 0, p = path; ndirs < n; p = colon + 1) {
+    colon = strchr(p, ':');
+    if (colon == NULL)
+      colon = p + strlen(p);
+    dirs[ndirs++] = colon == p ? strdup(".") : strndup(p, colon - p);
+    if (*colon == '\0')
+      break;
+  }
+}
+
+/* --- drop everything when PATH differs from the cached copy --- */
+static void checkpath(void)
+{
+  char *path = getenv("PATH");
+  if (path == NULL)
+    path = "/bin:/usr/bin";
+  if (cachedpath != NULL && strcmp(cachedpath, path) == 0)
+    return;
+  path_clear();
+  cachedpath = strdup(path);
+  splitpath(cachedpath);
+}
+
+/* --- bump dirgen if any PATH directory changed since the last call --- */
+static void statdirs(void)
+{
+  struct stat sb;
+  int i, changed = 0;
+
+  for (i = 0; i < ndirs; i++) {
+    if (stat(dirs[i], &sb) < 0)
+      sb.st_mtim.tv_sec = sb.st_mtim.tv_nsec = 0;
+    if (sb.st_mtim.tv_sec != dirtimes[i].tv_sec ||
+        sb.st_mtim.tv_nsec != dirtimes[i].tv_nsec) {
+      dirtimes[i] = sb.st_mtim;
+      changed = 1;
+    }
+  }
+  dirgen += changed;
+}
+
+/* --- search PATH for an executable regular file called name --- */
+static char *searchpath(char *name)
+{
+  struct stat sb;
+  size_t len = strlen(name);
+  int i;
+
+  for (i = 0; i < ndirs; i++) {
+    char file[strlen(dirs[i]) + len + 2];
+    sprintf(file, "%s/%s", dirs[i], name);
+    if (stat(file, &sb) == 0 && S_ISREG(sb.st_mode) && access(file, X_OK) == 0)
+      return strdup(file);
+  }
+  return NULL;
+}
+
+/*
+ * path_lookup : the file to exec for name. Names containing a slash
+ * are used as they are. The result belongs to the table.
+ */
+char *path_lookup(char *name)
+{
+  PathEntry *e;
+  unsigned b;
+
+  if (strchr(name, '/') != NULL)
+    return name;
+  checkpath();
+
+  b = strhash(name) & (BUCKETS - 1);
+  for (e = buckets[b]; e != NULL; e = e->next) {
+    if (strcmp(e->name, name) != 0)
+      continue;
+    if (e->path == NULL) { // A miss holds while no directory changed
+      statdirs();
+      if (e->gen != dirgen) {
+        e->path = searchpath(name);
+        e->gen = dirgen;
+      }
+    }
+    e->hits++;
+    return e->path;
+  }
+
+  e = malloc(sizeof(PathEntry));
+  e->name = strdup(name);
+  e->path = searchpath(name);
+  if (e->path == NULL) { // Remember what the directories looked like
+    statdirs();
+    e->gen = dirgen;
+  }
+  e->hits = 1;
+  e->next = buckets[b];
+  buckets[b] = e;
+  return e->path;
+}
+
+/* --- path_forget: remove the entry for name --- */
+void path_forget(char *name)
+{
+  PathEntry **pe, *e;
+
+  for (pe = &buckets[strhash(name) & (BUCKETS - 1)]; (e = *pe) != NULL; pe = &e->next) {
+    if (strcmp(e->name, name) == 0) {
+      *pe = e->next;
+      free(e->name);
+      free(e->path);
+      free(e);
+      return;
+    }
+  }
+}
+
+/* --- path_clear: empty the table --- */
+void path_clear(void)
+{
+  int i;
+
+  for (i = 0; i < BUCKETS; i++) {
+    while (buckets[i] != NULL) {
+      PathEntry *e = buckets[i];
+      buckets[i] = e->next;
+      free(e->name);
+      free(e->path);
+      free(e);
+    }
+  }
+  for (i = 0; i < ndirs; i++)
+    free(dirs[i]);
+  free(dirs);
+  free(dirtimes);
+  free(cachedpath);
+  dirs = NULL;
+  dirtimes = NULL;
+  cachedpath = NULL;
+  ndirs = 0;
+}
+
+/* --- path_list: write "hits command path" lines to fd --- */
+int path_list(int fd)
+{
+  PathEntry *e;
+  int i;
+
+  for (i = 0; i < BUCKETS; i++)
+    for (e = buckets[i]; e != NULL; e = e->next)
+      if (dprintf(fd, "%6u\t%s\t%s\n", e->hits, e->name,
+                  e->path ? e->path : "(not found)") < 0)
+        return 1;
+  return 0;
+}
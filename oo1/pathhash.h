@@ -0,0 +1,18 @@
+/*
+
+   pathhash.h
+
+   Command name -> absolute path cache, so a command is looked up in
+   PATH once instead of on every exec.
+
+ */
+
+#ifndef _PATHHASH_H
+#define _PATHHASH_H
+
+char *path_lookup(char *);  /* resolved path, or NULL when not found */
+void path_forget(char *);   /* drop one entry, e.g. after exec failed */
+void path_clear(void);      /* hash -r */
+int path_list(int);         /* hash: write the table to an fd */
+
+#endif
@@ -0,0 +1,91 @@
+/*
+
+   pipes.c
+
+   A pipe holds 64 KiB by default, so a stage that writes faster than
+   the next one reads is put to sleep every 64 KiB and the two ping-pong
+   through the scheduler. F_SETPIPE_SZ makes the buffer larger; the
+   kernel refuses sizes above /proc/sys/fs/pipe-max-size to users
+   without CAP_SYS_RESOURCE, so requests are clamped to that first.
+
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "pipes.h"
+
+/* --- symbolic constants --- */
+#define PIPEMAXFILE "/proc/sys/fs/pipe-max-size"
+
+long pipe_size = 0;
+
+/* --- pipe_init: BOSH_PIPESIZE sets the capacity at startup --- */
+void pipe_init(void)
+{
+  char *size = getenv("BOSH_PIPESIZE");
+  if (size != NULL && (pipe_size = pipe_parsesize(size)) < 0) {
+    fprintf(stderr, "BOSH_PIPESIZE: bad size \"%s\"\n", size);
+    pipe_size = 0;
+  }
+}
+
+/* --- pipe_parsesize: bytes in "64K", "1M", ...; -1 if malformed or too large --- */
+long pipe_parsesize(char *s)
+{
+  char *end;
+  int shift = 0;
+  long n;
+
+  errno = 0;
+  n = strtol(s, &end, 10);
+  if (end == s || n < 0 || errno == ERANGE)
+    return -1;
+  switch (toupper(*end)) {
+    case 'K': shift = 10; end++; break;
+    case 'M': shift = 20; end++; break;
+    case 'G': shift = 30; end++; break;
+  }
+  if (*end != '\0' || n > LONG_MAX >> shift)
+    return -1;
+  return n << shift;
+}
+
+/* --- pipe_maxsize: the largest capacity we may ask for --- */
+long pipe_maxsize(void)
+{
+  static long max = 0;
+  FILE *f;
+
+  if (max == 0) {
+    max = 1 << 20; // The kernel's default limit
+    if ((f = fopen(PIPEMAXFILE, "re")) != NULL) {
+      if (fscanf(f, "%ld", &max) != 1)
+        max = 1 << 20;
+      fclose(f);
+    }
+  }
+  return max;
+}
+
+/*
+ * mkpipe : pipe2 with close-on-exec, then grow it to size bytes (at
+ * most pipe_maxsize) unless size is 0. A pipe that cannot grow, e.g.
+ * because the user's pipe-user-pages-soft is used up, is still usable
+ * at its default size.
+ */
+int mkpipe(int fd[2], long size)
+{
+  if (pipe2(fd, O_CLOEXEC) < 0)
+    return -1;
+  if (size > 0)
+    fcntl(fd[1], F_SETPIPE_SZ, size < pipe_maxsize() ? size : pipe_maxsize());
+  return 0;
+}
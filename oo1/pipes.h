@@ -0,0 +1,19 @@
+/*
+
+   pipes.h
+
+   Pipes between pipeline stages, with a configurable capacity.
+
+ */
+
+#ifndef _PIPES_H
+#define _PIPES_H
+
+extern long pipe_size; /* capacity for new pipes; 0: the kernel's default */
+
+void pipe_init(void);
+long pipe_parsesize(char *);
+long pipe_maxsize(void);
+int mkpipe(int [2], long);
+
+#endif
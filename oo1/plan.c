@@ -0,0 +1,425 @@
+/*
+
+   plan.c
+
+   for and while loops:
+
+     for NAME in WORD ...        while COMMAND
+     do                          do
+       COMMANDS                    COMMANDS
+     done                        done
+
+   As in sh, the parts of a loop may also be separated by ;, as in
+   for i in a b; do echo $i; done. NAME is exported, so commands
+   see its value as $NAME and in their environment. The WORDs are
+   expanded ($..., wildcards) once, as the loop starts; a while loop
+   runs its body for as long as COMMAND exits with 0. Either stops
+   when a command is killed by ^C.
+
+   The lines of a loop are collected up to its done and then compiled
+   once into a plan: every command line is parsed into a Shellcmd of
+   its own (argv arrays, redirections, pipeline shape, << bodies) and
+   inner loops into plans of their own. Each pass runs the parsed
+   commands again, and executeshellcmd only has to expand $... and
+   wildcards, so a loop that runs a million times tokenizes its body
+   once.
+
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <signal.h>
+
+#include "plan.h"
+#include "parser.h"
+#include "execute.h"
+#include "builtin.h"
+#include "jobs.h"
+#include "subst.h"
+#include "wildcard.h"
+#include "trace.h"
+
+/* --- kinds of step --- */
+#define STEP_CMD   0
+#define STEP_FOR   1
+#define STEP_WHILE 2
+
+typedef struct _step {
+    struct _step *next;
+    int kind;
+    Shellcmd cmd;       /* the command; for: "in" and its words; while: the test */
+    char *name;         /* for: the variable */
+    struct _step *body; /* for, while */
+} Step;
+
+/* --- the lines of the loop being read, up to its done --- */
+static char **lines;
+static int nlines, linecap, depth;
+static char *bodyend;   /* the delimiter of a << body being read */
+
+#define interrupted(status) ((status) == 128 + SIGINT)
+
+/* --- is w the first word of line? Returns what follows it, or NULL --- */
+static char *keyword(char *line, char *w)
+{
+  size_t n = strlen(w);
+
+  while (isspace(*line))
+    line++;
+  if (strncmp(line, w, n) != 0 || (line[n] != '\0' && !isspace(line[n])))
+    return NULL;
+  return line + n;
+}
+
+/* --- is line blank or a comment? --- */
+static int blank(char *line)
+{
+  while (isspace(*line))
+    line++;
+  return *line == '\0' || *line == '#';
+}
+
+/* --- is line just w? --- */
+static int onlyword(char *line, char *w)
+{
+  char *rest = keyword(line, w);
+
+  if (rest == NULL)
+    return 0;
+  while (isspace(*rest))
+    rest++;
+  return *rest == '\0';
+}
+
+static int opens(char *line)
+{
+  return keyword(line, "for") != NULL || keyword(line, "while") != NULL;
+}
+
+static void keep(char *line)
+{
+  if (nlines == linecap)
+    lines = realloc(lines, (linecap = linecap ? linecap * 2 : 16) * sizeof(char *));
+  lines[nlines++] = strdup(line);
+}
+
+/* --- plan_heredelim: the WORD of a <<WORD in line (not <<<word), or NULL --- */
+char *plan_heredelim(char *line)
+{
+  char *p, *w;
+  size_t n;
+
+  for (p = line; (p = strstr(p, "<<")) != NULL; p += 2) {
+    if (p[2] == '<') { // <<<word
+      p++;
+      continue;
+    }
+    for (w = p + 2; isspace(*w); w++)
+      ;
+    n = strcspn(w, " \t|&<>;");
+    return n > 0 ? strndup(w, n) : NULL;
+  }
+  return NULL;
+}
+
+/* --- keep one ;-separated part of a line; a "do" in front is a line of its own --- */
+static void collectpart(char *part)
+{
+  char *rest;
+
+  while (isspace(*part))
+    part++;
+  if ((rest = keyword(part, "do")) != NULL && !blank(rest)) {
+    keep("do");
+    part = rest;
+    while (isspace(*part))
+      part++;
+  }
+  if (opens(part))
+    depth++;
+  else if (onlyword(part, "done"))
+    depth--;
+  if (!blank(part))
+    keep(part);
+  if (bodyend == NULL)
+    bodyend = plan_heredelim(part);
+}
+
+/* --- plan_semicolon: the first ; in line that is not inside $(...), or NULL --- */
+char *plan_semicolon(char *line)
+{
+  int nest = 0;
+
+  for (; *line != '\0'; line++) {
+    if (*line == '(')
+      nest++;
+    else if (*line == ')' && nest > 0)
+      nest--;
+    else if (*line == ';' && nest == 0)
+      return line;
+  }
+  return NULL;
+}
+
+/*
+ * plan_collect : keep line if it belongs to a loop, i.e. starts one
+ * or comes before the done that ends the loop being read. Its parts
+ * separated by ; are kept as lines of their own, except in << bodies,
+ * which are kept as they are. Returns 0, leaving the line to the
+ * caller, if it does not belong to a loop.
+ */
+int plan_collect(char *line)
+{
+  char *copy, *part, *end;
+
+  if (bodyend != NULL) {
+    if (strcmp(line, bodyend) == 0) {
+      free(bodyend);
+      bodyend = NULL;
+    }
+    keep(line);
+    return 1;
+  }
+  if (depth == 0 && !opens(line))
+    return 0;
+
+  copy = strdup(line);
+  for (part = copy; (end = plan_semicolon(part)) != NULL; part = end + 1) {
+    *end = '\0';
+    collectpart(part);
+  }
+  collectpart(part);
+  free(copy);
+  return 1;
+}
+
+/* --- plan_pending: is a loop waiting for more lines? --- */
+int plan_pending(void)
+{
+  return depth > 0;
+}
+
+/* --- plan_discard: forget the lines read so far --- */
+void plan_discard(void)
+{
+  while (nlines > 0)
+    free(lines[--nlines]);
+  free(bodyend);
+  bodyend = NULL;
+  depth = 0;
+}
+
+static void freesteps(Step *s)
+{
+  Step *next;
+
+  for (; s != NULL; s = next) {
+    next = s->next;
+    freeshellcmd(&s->cmd);
+    free(s->name);
+    freesteps(s->body);
+    free(s);
+  }
+}
+
+/* --- parse line into cmd; a << body comes from the lines after it --- */
+static int parseline(Shellcmd *cmd, char *line, int *i)
+{
+  if (parsecommand(line, cmd) <= 0)
+    return -1;
+  while (heredocpending(cmd) && *i < nlines)
+    if (heredocline(cmd, lines[(*i)++]) < 0)
+      return -1;
+  if (heredocpending(cmd)) {
+    fprintf(stderr, "here-document in a loop: no %s before done\n", cmd->rd_heredelim);
+    return -1;
+  }
+  return 0;
+}
+
+static Step *compile(int *, int *, int *);
+
+/* --- the do, body and done of loop s, from lines[*i..]; 0 or -1 --- */
+static int compilebody(Step *s, int *i)
+{
+  int hasdo = 0, done, err = 0;
+
+  while (!hasdo && *i < nlines) {
+    char *line = lines[(*i)++];
+    if (onlyword(line, "do"))
+      hasdo = 1;
+    else if (!blank(line))
+      break;
+  }
+  if (!hasdo) {
+    fprintf(stderr, "%s: missing do\n", s->kind == STEP_FOR ? "for" : "while");
+    return -1;
+  }
+  s->body = compile(i, &done, &err);
+  if (!err && !done) {
+    fprintf(stderr, "%s: missing done\n", s->kind == STEP_FOR ? "for" : "while");
+    return -1;
+  }
+  return err ? -1 : 0;
+}
+
+/* --- for NAME in WORD ...: rest is what follows the for --- */
+static int compilefor(Step *s, char *rest, int *i)
+{
+  char *name, *words;
+  int status;
+
+  s->kind = STEP_FOR;
+  while (isspace(*rest))
+    rest++;
+  for (name = rest; isalnum(*rest) || *rest == '_'; rest++)
+    ;
+  if (rest == name || isdigit(*name) || (words = keyword(rest, "in")) == NULL) {
+    fprintf(stderr, "usage: for NAME in WORD ...\n");
+    return -1;
+  }
+  s->name = strndup(name, rest - name);
+
+  // Parsed behind "in", so that no words at all still make a command;
+  // expansion may leave just that
+  if ((words = strdup(words - 2)) == NULL)
+    return -1;
+  status = parseline(&s->cmd, words, i);
+  free(words);
+  if (status < 0)
+    return -1;
+  return compilebody(s, i);
+}
+
+/* --- while COMMAND: rest is what follows the while --- */
+static int compilewhile(Step *s, char *rest, int *i)
+{
+  s->kind = STEP_WHILE;
+  if (parseline(&s->cmd, rest, i) < 0) {
+    fprintf(stderr, "usage: while COMMAND\n");
+    return -1;
+  }
+  return compilebody(s, i);
+}
+
+/*
+ * compile : the steps in lines[*i..], up to a done (*done is then set)
+ * or the last line. *err is set if some line would not compile.
+ */
+static Step *compile(int *i, int *done, int *err)
+{
+  Step *head = NULL, **tail = &head, *s;
+  char *line, *rest;
+
+  *done = 0;
+  while (*i < nlines && !*err) {
+    line = lines[(*i)++];
+    if (blank(line))
+      continue;
+    if (onlyword(line, "done")) {
+      *done = 1;
+      break;
+    }
+    s = calloc(1, sizeof(Step));
+    *tail = s;
+    tail = &s->next;
+    if ((rest = keyword(line, "for")) != NULL)
+      *err = compilefor(s, rest, i) < 0;
+    else if ((rest = keyword(line, "while")) != NULL)
+      *err = compilewhile(s, rest, i) < 0;
+    else
+      *err = parseline(&s->cmd, line, i) < 0;
+  }
+  return head;
+}
+
+static int runsteps(Step *);
+
+/*
+ * runfor : the body once for every word, with NAME set to it. While
+ * the loop runs, NAME=value lives in a buffer of our own that putenv
+ * puts in the environment: setenv would keep a copy of every value
+ * NAME was ever given, and look through all of them each time.
+ */
+static int runfor(Step *s)
+{
+  Arena words = { 0 };
+  Cmd *c = wildcard_cmds(&words, subst_cmds(&words, s->cmd.the_cmds));
+  size_t n = strlen(s->name), max = 0;
+  char **w, *var;
+  int status = 0;
+
+  for (w = c->cmd + 1; *w != NULL; w++)
+    if (strlen(*w) > max)
+      max = strlen(*w);
+  if (c->cmd[1] == NULL || (var = malloc(n + max + 2)) == NULL) {
+    arena_free(&words);
+    return 0;
+  }
+  memcpy(var, s->name, n);
+  var[n] = '=';
+
+  for (w = c->cmd + 1; *w != NULL && !shell_terminate && !interrupted(status); w++) {
+    strcpy(var + n + 1, *w);
+    putenv(var); // Again, in case the body set NAME itself
+    status = runsteps(s->body);
+  }
+  setenv(s->name, var + n + 1, 1); // The last value stays
+  free(var);
+  arena_free(&words);
+  return status;
+}
+
+/* --- while: the body for as long as the test succeeds --- */
+static int runwhile(Step *s)
+{
+  int status = 0;
+
+  while (!shell_terminate && !interrupted(status) &&
+         (shell_status = executeshellcmd(&s->cmd)) == 0)
+    status = runsteps(s->body);
+  return interrupted(shell_status) ? shell_status : status;
+}
+
+static int runsteps(Step *s)
+{
+  int status = 0;
+
+  for (; s != NULL && !shell_terminate && !interrupted(status); s = s->next) {
+    jobs_reap();
+    switch (s->kind) {
+      case STEP_FOR:
+        status = runfor(s);
+        break;
+      case STEP_WHILE:
+        status = runwhile(s);
+        break;
+      default:
+        status = executeshellcmd(&s->cmd);
+    }
+    shell_status = status;
+  }
+  return status;
+}
+
+/*
+ * plan_run : compile the loop that plan_collect has read, run it and
+ * throw it away. Returns the status of the last command it ran.
+ */
+int plan_run(void)
+{
+  Step *plan;
+  int i = 0, done, err = 0, status = 2;
+
+  trace_begin("compile");
+  plan = compile(&i, &done, &err);
+  trace_end("compile");
+  if (!err)
+    status = runsteps(plan);
+  freesteps(plan);
+  plan_discard();
+  return status;
+}
@@ -0,0 +1,19 @@
+/*
+
+   plan.h
+
+   for and while loops, compiled once into a plan of parsed commands.
+
+ */
+
+#ifndef _PLAN_H
+#define _PLAN_H
+
+int plan_collect(char *);
+char *plan_semicolon(char *);
+char *plan_heredelim(char *);
+int plan_pending(void);
+int plan_run(void);
+void plan_discard(void);
+
+#endif
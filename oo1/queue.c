@@ -0,0 +1,176 @@
+/*
+
+   queue.c
+
+   A queue is a ring buffer with a mutex and two condition variables.
+   queue_pipe hands out its two ends as "fds" numbered from
+   QUEUEFD_BASE, so a builtin takes them where it would take pipe ends;
+   bwrite, zcopy and bclose go through queue_read/queue_write/
+   queue_close, which pass real fds on to read/write/close. Closing the
+   write end gives the reader EOF, closing the read end gives writers
+   EPIPE, just like a pipe.
+
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "queue.h"
+
+/* --- symbolic constants --- */
+#define QUEUEMAX 256
+
+typedef struct _queue {
+    pthread_mutex_t lock;
+    pthread_cond_t readable, writable;
+    char *buf;
+    size_t size, head, len; /* bytes queued: buf[head .. head+len) mod size */
+    int reader, writer;     /* ends still open */
+} Queue;
+
+static Queue *queues[QUEUEMAX];
+static pthread_mutex_t tablelock = PTHREAD_MUTEX_INITIALIZER;
+
+/* --- the queue behind an end; fd & 1 tells which end it is --- */
+static Queue *queue_of(int fd)
+{
+  int i = (fd - QUEUEFD_BASE) >> 1;
+  return i >= 0 && i < QUEUEMAX ? queues[i] : NULL;
+}
+
+/*
+ * queue_pipe : like pipe(2), fd[0] reads and fd[1] writes, with room
+ * for size bytes. Returns -1 when every queue is in use, in which
+ * case the caller can make a real pipe instead.
+ */
+int queue_pipe(int fd[2], size_t size)
+{
+  Queue *q = calloc(1, sizeof(Queue));
+  int i;
+
+  if (q == NULL || (q->buf = malloc(size)) == NULL) {
+    free(q);
+    return -1;
+  }
+  pthread_mutex_init(&q->lock, NULL);
+  pthread_cond_init(&q->readable, NULL);
+  pthread_cond_init(&q->writable, NULL);
+  q->size = size;
+  q->reader = q->writer = 1;
+
+  pthread_mutex_lock(&tablelock);
+  for (i = 0; i < QUEUEMAX && queues[i] != NULL; i++);
+  if (i < QUEUEMAX)
+    queues[i] = q;
+  pthread_mutex_unlock(&tablelock);
+  if (i == QUEUEMAX) {
+    free(q->buf);
+    free(q);
+    errno = EMFILE;
+    return -1;
+  }
+  fd[0] = QUEUEFD_BASE + 2 * i;
+  fd[1] = QUEUEFD_BASE + 2 * i + 1;
+  return 0;
+}
+
+/* --- queue_read: read(2) for either kind of fd --- */
+ssize_t queue_read(int fd, void *buf, size_t n)
+{
+  Queue *q;
+  size_t k;
+
+  if (!queue_isfd(fd))
+    return read(fd, buf, n);
+  if ((q = queue_of(fd)) == NULL || (fd & 1)) {
+    errno = EBADF;
+    return -1;
+  }
+  pthread_mutex_lock(&q->lock);
+  while (q->len == 0 && q->writer)
+    pthread_cond_wait(&q->readable, &q->lock);
+  if (n > q->len)
+    n = q->len;
+  for (k = 0; k < n; ) { // At most two pieces around the end of buf
+    size_t piece = q->size - q->head < n - k ? q->size - q->head : n - k;
+    memcpy((char *) buf + k, q->buf + q->head, piece);
+    q->head = (q->head + piece) % q->size;
+    q->len -= piece;
+    k += piece;
+  }
+  pthread_cond_broadcast(&q->writable);
+  pthread_mutex_unlock(&q->lock);
+  return n;
+}
+
+/* --- queue_write: write(2) for either kind of fd; EPIPE once unread --- */
+ssize_t queue_write(int fd, const void *buf, size_t n)
+{
+  Queue *q;
+  size_t k, tail;
+
+  if (!queue_isfd(fd))
+    return write(fd, buf, n);
+  if ((q = queue_of(fd)) == NULL || !(fd & 1)) {
+    errno = EBADF;
+    return -1;
+  }
+  pthread_mutex_lock(&q->lock);
+  while (q->len == q->size && q->reader)
+    pthread_cond_wait(&q->writable, &q->lock);
+  if (!q->reader) {
+    pthread_mutex_unlock(&q->lock);
+    errno = EPIPE;
+    return -1;
+  }
+  if (n > q->size - q->len)
+    n = q->size - q->len;
+  for (k = 0; k < n; ) {
+    tail = (q->head + q->len) % q->size;
+    size_t piece = q->size - tail < n - k ? q->size - tail : n - k;
+    memcpy(q->buf + tail, (char *) buf + k, piece);
+    q->len += piece;
+    k += piece;
+  }
+  pthread_cond_broadcast(&q->readable);
+  pthread_mutex_unlock(&q->lock);
+  return n;
+}
+
+/* --- queue_close: close(2) for either kind of fd --- */
+int queue_close(int fd)
+{
+  Queue *q;
+  int gone;
+
+  if (!queue_isfd(fd))
+    return close(fd);
+  if ((q = queue_of(fd)) == NULL) {
+    errno = EBADF;
+    return -1;
+  }
+  pthread_mutex_lock(&q->lock);
+  if (fd & 1)
+    q->writer = 0;
+  else
+    q->reader = 0;
+  gone = !q->reader && !q->writer;
+  pthread_cond_broadcast(&q->readable);
+  pthread_cond_broadcast(&q->writable);
+  pthread_mutex_unlock(&q->lock);
+  if (!gone)
+    return 0;
+
+  pthread_mutex_lock(&tablelock);
+  queues[(fd - QUEUEFD_BASE) >> 1] = NULL;
+  pthread_mutex_unlock(&tablelock);
+  pthread_mutex_destroy(&q->lock);
+  pthread_cond_destroy(&q->readable);
+  pthread_cond_destroy(&q->writable);
+  free(q->buf);
+  free(q);
+  return 0;
+}
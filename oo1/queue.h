@@ -0,0 +1,26 @@
+/*
+
+   queue.h
+
+   Bounded in-memory byte queues that stand in for pipes between
+   builtin stages running as threads of the shell.
+
+ */
+
+#ifndef _QUEUE_H
+#define _QUEUE_H
+
+#include <sys/types.h>
+
+/* --- queue ends are numbered from here, far above any real fd --- */
+#define QUEUEFD_BASE (1 << 30)
+#define QUEUESIZE    (1 << 16)
+
+#define queue_isfd(fd) ((fd) >= QUEUEFD_BASE)
+
+int queue_pipe(int [2], size_t);
+ssize_t queue_read(int, void *, size_t);
+ssize_t queue_write(int, const void *, size_t);
+int queue_close(int);
+
+#endif
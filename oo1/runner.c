@@ -0,0 +1,154 @@
+/*
+
+   runner.c
+
+   Commands go through the shell's normal spawn path (spawncmd, or the
+   builtin table) and are tracked as one-stage jobs. When all slots are
+   busy, runner_submit blocks in job_waitany until any command exits,
+   so completions are reaped in the order they happen. With keep set,
+   each command writes into its own memfd, and the memfds are copied
+   to the output in submission order as soon as all earlier ones have
+   been copied.
+
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "runner.h"
+#include "launch.h"
+#include "builtin.h"
+#include "zcopy.h"
+
+/* --- runner_defaultslots: one per online CPU --- */
+int runner_defaultslots(void)
+{
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int) n : 1;
+}
+
+/*
+ * runner_init : slots in flight, keep order?, output fd. Returns 0,
+ * or -1 with nothing left to free (runner_finish is then a no-op).
+ */
+int runner_init(Runner *r, int slots, int keep, int out)
+{
+  memset(r, 0, sizeof(Runner));
+  r->slots = slots > 0 ? slots : runner_defaultslots();
+  r->keep = keep;
+  r->out = out;
+  r->jobs = malloc(r->slots * sizeof(Job *));
+  r->seqs = malloc(r->slots * sizeof(long));
+  r->bufs = malloc(r->slots * sizeof(int));
+  r->null = -1;
+  if (r->jobs == NULL || r->seqs == NULL || r->bufs == NULL ||
+      (r->null = open("/dev/null", O_RDONLY|O_CLOEXEC)) < 0) {
+    free(r->jobs);
+    free(r->seqs);
+    free(r->bufs);
+    r->jobs = NULL;
+    r->seqs = NULL;
+    r->bufs = NULL;
+    return -1; // errno from malloc or open
+  }
+  return 0;
+}
+
+/* --- copy finished outputs that are next in line --- */
+static void emit(Runner *r)
+{
+  while (r->emit < r->next && r->outs[r->emit] != -1) {
+    int fd = r->outs[r->emit];
+    lseek(fd, 0, SEEK_SET);
+    zcopy(fd, r->out, NULL);
+    close(fd);
+    r->outs[r->emit++] = -1;
+  }
+}
+
+/* --- submission seq finished with status, its output in buf --- */
+static void complete(Runner *r, long seq, int buf, int status)
+{
+  if (status != 0)
+    r->failed++;
+  if (!r->keep)
+    return;
+  r->outs[seq] = buf;
+  emit(r);
+}
+
+/* --- wait for one command in flight and free its slot --- */
+static void reapone(Runner *r)
+{
+  int i = job_waitany(r->jobs, r->busy);
+
+  complete(r, r->seqs[i], r->keep ? r->bufs[i] : -1, job_status(r->jobs[i]));
+  job_free(r->jobs[i]);
+  r->busy--;
+  r->jobs[i] = r->jobs[r->busy];
+  r->seqs[i] = r->seqs[r->busy];
+  r->bufs[i] = r->bufs[r->busy];
+}
+
+/*
+ * runner_submit : start argv once a slot is free. argv is not used
+ * after the call returns, so callers may reuse it. Returns -1 when
+ * the command could not be started.
+ */
+int runner_submit(Runner *r, char **argv)
+{
+  int buf = -1;
+  long seq;
+  Builtin *b;
+
+  while (r->busy == r->slots)
+    reapone(r);
+
+  seq = r->next++;
+  if (r->keep) {
+    if (seq >= r->outcap) {
+      long cap = r->outcap ? r->outcap * 2 : 64;
+      r->outs = realloc(r->outs, cap * sizeof(int));
+      while (r->outcap < cap)
+        r->outs[r->outcap++] = -1;
+    }
+    if ((buf = memfd_create("bosh-runner", MFD_CLOEXEC)) < 0) {
+      fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+      return -1;
+    }
+  }
+
+  // Builtins are quick enough to run on the spot, without a slot
+  if ((b = findbuiltin(argv[0])) != NULL) {
+    complete(r, seq, buf, runbuiltin(b, argv, r->null, r->keep ? buf : r->out, NULL, NULL));
+    return 0;
+  }
+
+  Job *job = job_new(1, argv[0], 0);
+  job_stagestart(job, 0, argv[0]);
+  job_setpid(job, 0, spawncmd(argv, r->null, r->keep ? buf : r->out, NULL, NULL));
+  r->jobs[r->busy] = job;
+  r->seqs[r->busy] = seq;
+  r->bufs[r->busy++] = buf;
+  return job->running > 0 ? 0 : -1;
+}
+
+/* --- runner_finish: wait for everything; 1 if any command failed --- */
+int runner_finish(Runner *r)
+{
+  while (r->busy > 0)
+    reapone(r);
+  if (r->null != -1)
+    close(r->null);
+  free(r->jobs);
+  free(r->seqs);
+  free(r->bufs);
+  free(r->outs);
+  return r->failed > 0;
+}
@@ -0,0 +1,33 @@
+/*
+
+   runner.h
+
+   Run many independent commands with at most N of them in flight.
+
+ */
+
+#ifndef _RUNNER_H
+#define _RUNNER_H
+
+#include "jobs.h"
+
+typedef struct _runner {
+    int slots;      /* max commands in flight */
+    int keep;       /* emit output in submission order */
+    int out;        /* where output goes */
+    int null;       /* stdin for the commands */
+    int busy;
+    Job **jobs;     /* in flight, [0, busy) */
+    long *seqs;     /* submission number of each job in flight */
+    int *bufs;      /* keep: memfd collecting each job's output */
+    int *outs;      /* keep: finished output per submission number */
+    long next, emit, outcap;
+    int failed;
+} Runner;
+
+int runner_init(Runner *, int, int, int);
+int runner_submit(Runner *, char **);
+int runner_finish(Runner *);
+int runner_defaultslots(void);
+
+#endif
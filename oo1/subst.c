@@ -0,0 +1,223 @@
+/*
+
+   subst.c
+
+   A word holding $(cmd) is replaced by the output of cmd, trailing
+   newlines dropped and split at blanks into separate words. cmd is
+   parsed into a Shellcmd of its own (one per part, if ; separates
+   several) and run by executeto with its
+   stdout on a memfd, so it may print any amount without anyone having
+   to read concurrently, and is then read back into one buffer. When
+   cmd is a single builtin, executeto runs it inside the shell, so such
+   a substitution costs no fork at all.
+
+   $NAME and ${NAME} are replaced by the variable's value from the
+   environment (nothing if it is unset) and $? by the status of the
+   last command; their values are split at blanks too.
+
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "subst.h"
+#include "execute.h"
+#include "builtin.h"
+#include "plan.h"
+
+/* --- symbolic constants --- */
+#define BLANKS    " \t\n"
+
+/* --- where the $( at s is closed, or the end of s --- */
+static char *substend(char *s)
+{
+  int depth = 0;
+
+  for (s++; *s != '\0'; s++) {
+    if (*s == '(')
+      depth++;
+    else if (*s == ')' && --depth == 0)
+      return s;
+  }
+  return s;
+}
+
+/* --- how long the $... at s is; 0 if it is just a $ --- */
+static size_t substlen(char *s)
+{
+  char *end;
+  size_t n;
+
+  if (s[1] == '(')
+    return *(end = substend(s)) != '\0' ? end + 1 - s : end - s;
+  if (s[1] == '?')
+    return 2;
+  if (s[1] == '{')
+    return (end = strchr(s, '}')) != NULL && end > s + 2 ? end + 1 - s : 0;
+  for (n = 1; isalpha(s[n]) || s[n] == '_' || (n > 1 && isdigit(s[n])); n++)
+    ;
+  return n > 1 ? n : 0;
+}
+
+/* --- subst_has: does word hold a $(...), $NAME, ${NAME} or $? --- */
+int subst_has(char *word)
+{
+  for (; (word = strchr(word, '$')) != NULL; word++)
+    if (substlen(word) > 0)
+      return 1;
+  return 0;
+}
+
+/*
+ * subst_capture : run cmdline and return what it wrote to stdout, in
+ * a malloc'd buffer of *len bytes plus a NUL, or NULL if it could not
+ * run. exit inside cmdline does not end the shell.
+ */
+char *subst_capture(char *cmdline, size_t *len)
+{
+  Shellcmd inner = { 0 };
+  int terminate = shell_terminate;
+  char *buf = NULL, *copy, *part, *end;
+  struct stat sb;
+  int fd;
+  ssize_t k;
+
+  *len = 0;
+  if ((fd = memfd_create("bosh-subst", MFD_CLOEXEC)) < 0) {
+    fprintf(stderr, "$(%s): %s\n", cmdline, strerror(errno));
+    return NULL;
+  }
+  for (part = copy = strdup(cmdline); part != NULL; part = end) { // a; b
+    if ((end = plan_semicolon(part)) != NULL)
+      *end++ = '\0';
+    if (parsecommand(part, &inner) > 0)
+      executeto(&inner, fd);
+    freeshellcmd(&inner);
+  }
+  free(copy);
+  shell_terminate = terminate;
+
+  if (fstat(fd, &sb) == 0 && (buf = malloc(sb.st_size + 1)) != NULL) {
+    while (*len < (size_t) sb.st_size &&
+           (k = pread(fd, buf + *len, sb.st_size - *len, *len)) > 0)
+      *len += k;
+    buf[*len] = '\0';
+  }
+  close(fd);
+  return buf;
+}
+
+/* --- append n bytes to a malloc'd buffer --- */
+static char *append(char *buf, size_t *len, size_t *cap, const char *s, size_t n)
+{
+  if (*len + n + 1 > *cap) {
+    while (*len + n + 1 > *cap)
+      *cap = *cap ? *cap * 2 : 64;
+    buf = realloc(buf, *cap);
+  }
+  memcpy(buf + *len, s, n);
+  *len += n;
+  buf[*len] = '\0';
+  return buf;
+}
+
+/* --- subst_word: word with every $... replaced by its value, in a --- */
+char *subst_word(Arena *a, char *word)
+{
+  size_t len = 0, cap = 0, n, k;
+  char *buf = NULL, *s, *end, *text, *res, status[16];
+
+  for (s = word; *s != '\0'; s += k) {
+    if (*s != '$' || (k = substlen(s)) == 0) {
+      buf = append(buf, &len, &cap, s, k = 1);
+      continue;
+    }
+    if (s[1] == '?') {
+      n = snprintf(status, sizeof(status), "%d", shell_status);
+      buf = append(buf, &len, &cap, status, n);
+      continue;
+    }
+    if (s[1] != '(') { // $NAME or ${NAME}
+      text = s[1] == '{' ? strndup(s + 2, k - 3) : strndup(s + 1, k - 1);
+      if ((res = getenv(text)) != NULL)
+        buf = append(buf, &len, &cap, res, strlen(res));
+      free(text);
+      continue;
+    }
+    end = substend(s);
+    text = strndup(s + 2, end - (s + 2));
+    if ((res = subst_capture(text, &n)) != NULL) {
+      while (n > 0 && res[n-1] == '\n') // Trailing newlines go
+        n--;
+      buf = append(buf, &len, &cap, res, n);
+      free(res);
+    }
+    free(text);
+  }
+
+  res = arena_strndup(a, buf != NULL ? buf : "", len);
+  free(buf);
+  return res;
+}
+
+/* --- the words of argv after expansion, in a; NULL-terminated --- */
+static char **expandargv(Arena *a, char **argv)
+{
+  char **words = NULL, **v, *w, *p, *save;
+  int n = 0, cap = 0, i;
+
+  for (; *argv != NULL; argv++) {
+    // A plain word stays as it is; values are split at blanks, maybe into none
+    w = subst_has(*argv) ? subst_word(a, *argv) : NULL;
+    for (p = w ? strtok_r(w, BLANKS, &save) : *argv; p != NULL;
+         p = w ? strtok_r(NULL, BLANKS, &save) : NULL) {
+      if (n == cap)
+        words = realloc(words, (cap = cap ? cap * 2 : 16) * sizeof(char *));
+      words[n++] = p;
+    }
+  }
+
+  v = arena_alloc(a, (n + 1) * sizeof(char *));
+  for (i = 0; i < n; i++)
+    v[i] = words[i];
+  v[n] = NULL;
+  free(words);
+  return v;
+}
+
+/*
+ * subst_cmds : cmds itself when no word holds a $..., otherwise a copy
+ * in a with every substitution done. A command left without any words
+ * becomes true, as an empty command does nothing.
+ */
+Cmd *subst_cmds(Arena *a, Cmd *cmds)
+{
+  static char *empty[] = { "true", NULL };
+  Cmd *c, *copy = NULL, **tail = &copy;
+  char **w;
+  int found = 0;
+
+  for (c = cmds; c != NULL && !found; c = c->next)
+    for (w = c->cmd; *w != NULL && !found; w++)
+      found = subst_has(*w);
+  if (!found)
+    return cmds;
+
+  for (c = cmds; c != NULL; c = c->next) {
+    Cmd *n = arena_alloc(a, sizeof(Cmd));
+    n->cmd = expandargv(a, c->cmd);
+    if (n->cmd[0] == NULL)
+      n->cmd = empty;
+    n->next = NULL;
+    *tail = n;
+    tail = &n->next;
+  }
+  return copy;
+}
@@ -0,0 +1,19 @@
+/*
+
+   subst.h
+
+   $(...) command substitution and $NAME, ${NAME}, $? expansion.
+
+ */
+
+#ifndef _SUBST_H
+#define _SUBST_H
+
+#include "parser.h"
+
+int subst_has(char *);
+Cmd *subst_cmds(Arena *, Cmd *);
+char *subst_word(Arena *, char *);
+char *subst_capture(char *, size_t *);
+
+#endif
@@ -0,0 +1,196 @@
+/*
+
+   trace.c
+
+   Events go into a fixed ring buffer, so a long session costs no more
+   memory than a short one and the newest TRACEMAX events survive; the
+   ring is written out as {"traceEvents": [...]} when tracing stops or
+   the shell exits. Timestamps are CLOCK_MONOTONIC microseconds, as in
+   JobStage. Everything happens in the shell process with pid = the
+   shell's; each child gets its own row, tid = its pid, so a pipeline
+   shows as stacked stages. Stages fused into threads report from
+   their own thread, hence the lock.
+
+   BOSH_TRACE=file, or set -o trace[=file], turns tracing on.
+
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+/* --- symbolic constants --- */
+#define TRACEMAX  (1 << 16)
+#define TRACENAME 64
+#define TRACEDEFAULT "bosh-trace.json"
+
+typedef struct _traceevent {
+    char ph;        /* B, E: begin/end; X: span; i: instant; M: row name */
+    double ts, dur; /* usec */
+    pid_t tid;
+    int status;     /* exit status of a span, -1 if none */
+    char name[TRACENAME];
+} TraceEvent;
+
+int trace_on = 0;
+
+static TraceEvent *ring;
+static unsigned long nevents; /* ever recorded; the ring holds the last TRACEMAX */
+static char *tracefile;
+static pthread_mutex_t tracelock = PTHREAD_MUTEX_INITIALIZER;
+
+static double usec(struct timespec ts)
+{
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return usec(ts);
+}
+
+static void record(char ph, char *name, double ts, double dur, pid_t tid, int status)
+{
+  TraceEvent *e;
+
+  pthread_mutex_lock(&tracelock);
+  e = &ring[nevents++ % TRACEMAX];
+  e->ph = ph;
+  e->ts = ts;
+  e->dur = dur;
+  e->tid = tid;
+  e->status = status;
+  snprintf(e->name, TRACENAME, "%s", name);
+  pthread_mutex_unlock(&tracelock);
+}
+
+static void trace_atexit(void)
+{
+  trace_stop();
+}
+
+/* --- trace_init: BOSH_TRACE=file starts tracing with the shell --- */
+void trace_init(void)
+{
+  char *file = getenv("BOSH_TRACE");
+
+  if (file != NULL)
+    trace_start(*file ? file : NULL);
+  atexit(trace_atexit);
+}
+
+/* --- trace_start: record from now on, for file (NULL: the default) --- */
+int trace_start(char *file)
+{
+  if (ring == NULL && (ring = malloc(TRACEMAX * sizeof(TraceEvent))) == NULL)
+    return -1;
+  free(tracefile);
+  tracefile = strdup(file != NULL ? file : TRACEDEFAULT);
+  if (!trace_on)
+    nevents = 0;
+  trace_on = 1;
+  record('M', "bosh", now(), 0, getpid(), -1);
+  return 0;
+}
+
+char *trace_file(void)
+{
+  return tracefile;
+}
+
+/* --- JSON string contents --- */
+static void putescaped(FILE *f, char *s)
+{
+  for (; *s != '\0'; s++) {
+    if (*s == '"' || *s == '\\')
+      fprintf(f, "\\%c", *s);
+    else if ((unsigned char) *s < ' ')
+      fprintf(f, "\\u%04x", *s);
+    else
+      putc(*s, f);
+  }
+}
+
+/* --- trace_stop: write the ring to the trace file and stop --- */
+int trace_stop(void)
+{
+  unsigned long i = nevents > TRACEMAX ? nevents - TRACEMAX : 0;
+  pid_t pid = getpid();
+  FILE *f;
+
+  if (!trace_on)
+    return 0;
+  trace_on = 0;
+  if ((f = fopen(tracefile, "we")) == NULL) {
+    fprintf(stderr, "trace: %s: %s\n", tracefile, strerror(errno));
+    return 1;
+  }
+  fprintf(f, "{\"traceEvents\": [\n");
+  for (; i < nevents; i++) {
+    TraceEvent *e = &ring[i % TRACEMAX];
+    if (e->ph == 'M') {
+      fprintf(f, "{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": %d, \"tid\": %d,"
+              " \"args\": {\"name\": \"", pid, e->tid);
+      putescaped(f, e->name);
+      fprintf(f, " %d\"}}", e->tid);
+    }
+    else {
+      fprintf(f, "{\"ph\": \"%c\", \"name\": \"", e->ph);
+      putescaped(f, e->name);
+      fprintf(f, "\", \"ts\": %.3f, \"pid\": %d, \"tid\": %d", e->ts, pid, e->tid);
+      if (e->ph == 'X')
+        fprintf(f, ", \"dur\": %.3f", e->dur);
+      if (e->ph == 'i')
+        fprintf(f, ", \"s\": \"t\"");
+      if (e->status != -1)
+        fprintf(f, ", \"args\": {\"status\": %d}", e->status);
+      putc('}', f);
+    }
+    fprintf(f, i + 1 < nevents ? ",\n" : "\n");
+  }
+  fprintf(f, "]}\n");
+  return fclose(f) != 0;
+}
+
+/* --- B/E pair on the shell's own row --- */
+void trace_begin(char *name)
+{
+  if (trace_on)
+    record('B', name, now(), 0, gettid(), -1);
+}
+
+void trace_end(char *name)
+{
+  if (trace_on)
+    record('E', name, now(), 0, gettid(), -1);
+}
+
+/*
+ * trace_span : something that ran from start to end on row tid (a
+ * child's pid, or 0 for the calling thread), with an exit status or -1.
+ * A child's first span also names its row.
+ */
+void trace_span(char *name, struct timespec start, struct timespec end,
+                pid_t tid, int status)
+{
+  if (!trace_on)
+    return;
+  if (tid > 0)
+    record('M', name, usec(start), 0, tid, -1);
+  record('X', name, usec(start), usec(end) - usec(start), tid > 0 ? tid : gettid(), status);
+}
+
+/* --- trace_instant: a point in time on row tid (0: this thread) --- */
+void trace_instant(char *name, pid_t tid)
+{
+  if (trace_on)
+    record('i', name, now(), 0, tid > 0 ? tid : gettid(), -1);
+}
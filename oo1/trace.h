@@ -0,0 +1,27 @@
+/*
+
+   trace.h
+
+   Timeline of parsing, spawning and exits, written as Chrome
+   trace-event JSON (chrome://tracing, Perfetto).
+
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <time.h>
+#include <sys/types.h>
+
+extern int trace_on;
+
+void trace_init(void);
+int trace_start(char *);
+int trace_stop(void);
+char *trace_file(void);
+void trace_begin(char *);
+void trace_end(char *);
+void trace_span(char *, struct timespec, struct timespec, pid_t, int);
+void trace_instant(char *, pid_t);
+
+#endif
@@ -0,0 +1,360 @@
+/*
+
+   wildcard.c
+
+   A word holding *, ? or [...] is replaced by the names it matches,
+   sorted; a word that matches nothing is left as it is, as in sh.
+   Names starting with a dot are only matched by a pattern that does,
+   and . and .. never are.
+
+   Directories are read with getdents64 into a large buffer, so one
+   holding 100k files takes a handful of system calls rather than one
+   readdir refill per 32K. Each listing is kept for the rest of the
+   command line, keyed by the directory's device, inode and mtime, so
+   "ls *.c *.h *.o" reads the directory once, not three times. Matches
+   are sorted by byte value with a multikey quicksort, which looks at
+   each character of a shared prefix once instead of once per strcmp.
+
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "wildcard.h"
+
+/* --- symbolic constants --- */
+#define DENTSBUF (1 << 20)  /* getdents64 batch */
+#define SMALLSORT 16        /* insertion sort below this */
+
+/* --- one directory as read for this command line --- */
+typedef struct _dirlist {
+    struct _dirlist *next;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    int n;
+    char **names;          /* in a */
+    unsigned char *types;  /* DT_* per name */
+} DirList;
+
+typedef struct _glob {
+    Arena *a;              /* names and matches */
+    DirList *dirs;
+    char *dents;           /* getdents64 buffer, allocated on first use */
+    char **matches;
+    int n, cap;
+} Glob;
+
+/* --- p at '[': past the ']' if c is in the set, NULL if not, p if no ']' --- */
+static const char *bracket(const char *p, const char *pend, unsigned char c)
+{
+  const char *q = p + 1, *first;
+  int neg = 0, in = 0;
+
+  if (q < pend && (*q == '!' || *q == '^')) {
+    neg = 1;
+    q++;
+  }
+  for (first = q; q < pend && (*q != ']' || q == first); q++) {
+    if (q + 2 < pend && q[1] == '-' && q[2] != ']') {
+      in |= (unsigned char) q[0] <= c && c <= (unsigned char) q[2];
+      q += 2;
+    }
+    else
+      in |= (unsigned char) *q == c;
+  }
+  if (q >= pend) // A lone [ stands for itself
+    return p;
+  return in != neg ? q + 1 : NULL;
+}
+
+/*
+ * wildcard_match : does the pattern p..pend match all of s? A * goes
+ * back to the last star only, so this never takes more than
+ * len(p) * len(s) steps.
+ */
+int wildcard_match(const char *p, const char *pend, const char *s)
+{
+  const char *star = NULL, *back = NULL, *q;
+
+  while (*s != '\0') {
+    if (p < pend && *p == '*') {
+      star = ++p;
+      back = s;
+      continue;
+    }
+    if (p < pend && *p == '?') {
+      p++;
+      s++;
+      continue;
+    }
+    if (p < pend && *p == '[' && (q = bracket(p, pend, *s)) != p) {
+      if (q != NULL) {
+        p = q;
+        s++;
+        continue;
+      }
+    }
+    else if (p < pend && *p == *s) {
+      p++;
+      s++;
+      continue;
+    }
+    if (star == NULL)
+      return 0;
+    p = star;
+    s = ++back;
+  }
+  while (p < pend && *p == '*')
+    p++;
+  return p == pend;
+}
+
+/* --- does the pattern p..pend hold a wildcard? --- */
+static int haswild(const char *p, const char *pend)
+{
+  for (; p < pend; p++)
+    if (*p == '*' || *p == '?' ||
+        (*p == '[' && pend - p > 2 && memchr(p + 2, ']', pend - p - 2) != NULL))
+      return 1;
+  return 0;
+}
+
+/* --- multikey quicksort of v[0..n) on the bytes from d on --- */
+static void mkqsort(char **v, int n, int d)
+{
+  char *t;
+  int i, j, lt, gt, pivot, c;
+
+  while (n > 1) {
+    if (n < SMALLSORT) {
+      for (i = 1; i < n; i++)
+        for (j = i; j > 0 && strcmp(v[j-1] + d, v[j] + d) > 0; j--) {
+          t = v[j];
+          v[j] = v[j-1];
+          v[j-1] = t;
+        }
+      return;
+    }
+    t = v[0];
+    v[0] = v[n/2];
+    v[n/2] = t;
+    pivot = (unsigned char) v[0][d];
+    for (lt = 0, i = 0, gt = n - 1; i <= gt; ) {
+      c = (unsigned char) v[i][d];
+      t = v[i];
+      if (c < pivot) {
+        v[i++] = v[lt];
+        v[lt++] = t;
+      }
+      else if (c > pivot) {
+        v[i] = v[gt];
+        v[gt--] = t;
+      }
+      else
+        i++;
+    }
+    mkqsort(v, lt, d);
+    mkqsort(v + gt + 1, n - gt - 1, d);
+    if (pivot == '\0') // All equal, and all ended
+      return;
+    v += lt; // Next byte of the ones that agreed on this one
+    n = gt - lt + 1;
+    d++;
+  }
+}
+
+/* --- wildcard_sort: names in byte order, as the C locale has it --- */
+void wildcard_sort(char **v, int n)
+{
+  mkqsort(v, n, 0);
+}
+
+/* --- the listing of directory path, read now or earlier on this line --- */
+static DirList *listdir(Glob *g, char *path)
+{
+  struct stat sb;
+  DirList *d;
+  int fd, cap = 0;
+  long k, off;
+
+  if ((fd = open(path, O_RDONLY|O_DIRECTORY|O_CLOEXEC)) < 0)
+    return NULL;
+  if (fstat(fd, &sb) < 0) {
+    close(fd);
+    return NULL;
+  }
+  for (d = g->dirs; d != NULL; d = d->next)
+    if (d->dev == sb.st_dev && d->ino == sb.st_ino &&
+        d->mtime.tv_sec == sb.st_mtim.tv_sec && d->mtime.tv_nsec == sb.st_mtim.tv_nsec) {
+      close(fd);
+      return d;
+    }
+
+  if ((g->dents == NULL && (g->dents = malloc(DENTSBUF)) == NULL) ||
+      (d = calloc(1, sizeof(DirList))) == NULL) {
+    close(fd);
+    return NULL;
+  }
+  d->dev = sb.st_dev;
+  d->ino = sb.st_ino;
+  d->mtime = sb.st_mtim;
+  while ((k = getdents64(fd, g->dents, DENTSBUF)) > 0)
+    for (off = 0; off < k; ) {
+      struct dirent64 *e = (struct dirent64 *) (g->dents + off);
+      off += e->d_reclen;
+      if (e->d_name[0] == '.' && (e->d_name[1] == '\0' ||
+                                  (e->d_name[1] == '.' && e->d_name[2] == '\0')))
+        continue;
+      if (d->n == cap) {
+        cap = cap ? cap * 2 : 256;
+        d->names = realloc(d->names, cap * sizeof(char *));
+        d->types = realloc(d->types, cap);
+      }
+      d->names[d->n] = arena_strndup(g->a, e->d_name, strlen(e->d_name));
+      d->types[d->n++] = e->d_type;
+    }
+  if (k < 0)
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+  close(fd);
+  d->next = g->dirs;
+  g->dirs = d;
+  return d;
+}
+
+static void addmatch(Glob *g, char *path, size_t len)
+{
+  if (g->n == g->cap)
+    g->matches = realloc(g->matches, (g->cap = g->cap ? g->cap * 2 : 64) * sizeof(char *));
+  g->matches[g->n++] = arena_strndup(g->a, path, len);
+}
+
+/*
+ * expand : add the names matching pat (the rest of a pattern) below
+ * path[0..len), which is empty or ends in a slash.
+ */
+static void expand(Glob *g, char *path, size_t len, char *pat)
+{
+  char *end = strchrnul(pat, '/'), *next = end;
+  struct stat sb;
+  DirList *d;
+  size_t n, k;
+  int i;
+
+  while (*next == '/')
+    next++;
+  if (!haswild(pat, end)) { // Taken as it is, if it is there
+    if (len + (next - pat) >= PATH_MAX)
+      return;
+    memcpy(path + len, pat, next - pat);
+    path[len += next - pat] = '\0';
+    if (*next != '\0')
+      expand(g, path, len, next);
+    else if ((end == next ? lstat(path, &sb) : stat(path, &sb)) == 0)
+      addmatch(g, path, len);
+    return;
+  }
+
+  path[len] = '\0';
+  if ((d = listdir(g, len > 0 ? path : ".")) == NULL)
+    return;
+  for (i = 0; i < d->n; i++) {
+    char *name = d->names[i];
+    if ((name[0] == '.' && pat[0] != '.') || !wildcard_match(pat, end, name))
+      continue;
+    n = strlen(name);
+    k = len + n + (next - end);
+    if (k >= PATH_MAX)
+      continue;
+    memcpy(path + len, name, n);
+    memcpy(path + len + n, end, next - end);
+    path[k] = '\0';
+    if (end == next) // Last part of the pattern
+      addmatch(g, path, k);
+    else if (d->types[i] == DT_DIR ||
+             ((d->types[i] == DT_LNK || d->types[i] == DT_UNKNOWN) &&
+              stat(path, &sb) == 0 && S_ISDIR(sb.st_mode))) {
+      if (*next == '\0') // Pattern ends in a slash: directories only
+        addmatch(g, path, k);
+      else
+        expand(g, path, k, next);
+    }
+  }
+}
+
+/* --- the words of argv with patterns expanded, in a; NULL-terminated --- */
+static char **expandargv(Glob *g, char **argv)
+{
+  char path[PATH_MAX], **v, *w;
+  int start, argc = 0, i;
+
+  g->n = 0;
+  for (; *argv != NULL; argv++) {
+    w = *argv;
+    start = g->n;
+    if (haswild(w, w + strlen(w))) {
+      if (*w == '/') {
+        path[0] = '/';
+        expand(g, path, 1, w + 1);
+      }
+      else
+        expand(g, path, 0, w);
+      wildcard_sort(g->matches + start, g->n - start);
+    }
+    if (g->n == start) // No match: the word stays
+      addmatch(g, w, strlen(w));
+  }
+
+  argc = g->n;
+  v = arena_alloc(g->a, (argc + 1) * sizeof(char *));
+  for (i = 0; i < argc; i++)
+    v[i] = g->matches[i];
+  v[argc] = NULL;
+  return v;
+}
+
+/*
+ * wildcard_cmds : cmds itself when no word holds a wildcard, otherwise
+ * a copy in a with every pattern expanded. Directory listings are
+ * shared by all words of all commands.
+ */
+Cmd *wildcard_cmds(Arena *a, Cmd *cmds)
+{
+  Glob g = { a };
+  Cmd *c, *copy = NULL, **tail = &copy;
+  DirList *d;
+  char **w;
+  int found = 0;
+
+  for (c = cmds; c != NULL && !found; c = c->next)
+    for (w = c->cmd; *w != NULL && !found; w++)
+      found = haswild(*w, *w + strlen(*w));
+  if (!found)
+    return cmds;
+
+  for (c = cmds; c != NULL; c = c->next) {
+    Cmd *n = arena_alloc(a, sizeof(Cmd));
+    n->cmd = expandargv(&g, c->cmd);
+    n->next = NULL;
+    *tail = n;
+    tail = &n->next;
+  }
+
+  while ((d = g.dirs) != NULL) {
+    g.dirs = d->next;
+    free(d->names);
+    free(d->types);
+    free(d);
+  }
+  free(g.dents);
+  free(g.matches);
+  return copy;
+}
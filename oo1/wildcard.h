@@ -0,0 +1,18 @@
+/*
+
+   wildcard.h
+
+   *, ? and [...] filename expansion.
+
+ */
+
+#ifndef _WILDCARD_H
+#define _WILDCARD_H
+
+#include "parser.h"
+
+Cmd *wildcard_cmds(Arena *, Cmd *);
+int wildcard_match(const char *, const char *, const char *);
+void wildcard_sort(char **, int);
+
+#endif
@@ -0,0 +1,157 @@
+/*
+
+   xargs.c
+
+   Items are read in large chunks and copied once, into a batch buffer
+   that lives as long as the xargs call; the argv handed to the runner
+   points into it. A batch is submitted as soon as the next item would
+   take it past ARG_MAX (less what the environment and the command
+   itself use), or past the -n limit. runner_submit is done with argv
+   when it returns, so the same buffer and argv array serve every batch.
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "xargs.h"
+
+/* --- symbolic constants --- */
+#define XARGSREAD   (1 << 16)
+#define ARGSLACK    4096        /* headroom below ARG_MAX */
+#define ARGSTRMAX   (32 * 4096) /* longest single argument (MAX_ARG_STRLEN) */
+
+extern char **environ;
+
+typedef struct _batch {
+    char *strs;      /* the items, each NUL-terminated */
+    size_t len, cap;
+    size_t *offs;    /* where each item starts in strs */
+    char **argv;     /* command words, then the items */
+    int nitems, itemcap;
+    long cost;       /* bytes the items add to the exec */
+} Batch;
+
+/* --- what a string costs an exec: itself, its NUL and its pointer --- */
+static long argcost(const char *s)
+{
+  return strlen(s) + 1 + sizeof(char *);
+}
+
+/* --- bytes left for items once the environment and cmd are in --- */
+static long argbudget(char **cmd)
+{
+  long budget = sysconf(_SC_ARG_MAX);
+  char **v;
+
+  if (budget <= 0)
+    budget = 128 * 1024; // POSIX minimum is 4096; every Linux has more
+  budget -= ARGSLACK + sizeof(char *);
+  for (v = environ; *v != NULL; v++)
+    budget -= argcost(*v);
+  for (v = cmd; *v != NULL; v++)
+    budget -= argcost(*v);
+  return budget;
+}
+
+/* --- run the first n items of the batch and forget them --- */
+static void submit(Runner *r, Batch *b, int ncmd, int n)
+{
+  int i;
+
+  if (n == 0)
+    return;
+  b->argv = realloc(b->argv, (ncmd + b->itemcap + 1) * sizeof(char *));
+  for (i = 0; i < n; i++)
+    b->argv[ncmd + i] = b->strs + b->offs[i];
+  b->argv[ncmd + n] = NULL;
+  runner_submit(r, b->argv);
+}
+
+/* --- room for one more byte in strs --- */
+static void growstrs(Batch *b)
+{
+  if (b->len == b->cap) {
+    b->cap = b->cap ? b->cap * 2 : XARGSREAD;
+    b->strs = realloc(b->strs, b->cap);
+  }
+}
+
+/*
+ * xargs : read items from in, separated by sep (or XARGS_BLANKS), and
+ * run cmd with as many of them appended as fit (at most maxitems, if
+ * that is > 0) through r. Returns 1 if input could not be read or an
+ * item had to be skipped, else 0.
+ */
+int xargs(Runner *r, int in, char **cmd, int maxitems, int sep)
+{
+  Batch b = { 0 };
+  char rbuf[XARGSREAD];
+  long budget = argbudget(cmd);
+  int ncmd, status = 0;
+  size_t start = 0; // Where the item being read starts in strs
+  ssize_t n, i;
+
+  for (ncmd = 0; cmd[ncmd] != NULL; ncmd++);
+  b.argv = malloc((ncmd + 1) * sizeof(char *));
+  memcpy(b.argv, cmd, ncmd * sizeof(char *));
+
+  for (;;) {
+    n = read(in, rbuf, sizeof(rbuf));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      fprintf(stderr, "xargs: %s\n", strerror(errno));
+      status = 1;
+    }
+    for (i = 0; i < (n > 0 ? n : 1); i++) {
+      int end = n <= 0 || (sep == XARGS_BLANKS ? rbuf[i] == ' ' || rbuf[i] == '\t' ||
+                                                 rbuf[i] == '\n' : rbuf[i] == sep);
+      if (!end) {
+        growstrs(&b);
+        b.strs[b.len++] = rbuf[i];
+        continue;
+      }
+      if (b.len == start && (sep == XARGS_BLANKS || n <= 0))
+        continue; // No item between two blanks, or at EOF
+      growstrs(&b);
+      b.strs[b.len++] = '\0';
+
+      char *item = b.strs + start;
+      long cost = argcost(item);
+      if (cost - sizeof(char *) > ARGSTRMAX || cost > budget) {
+        fprintf(stderr, "xargs: argument too long: %.20s...\n", item);
+        b.len = start;
+        status = 1;
+        continue;
+      }
+      if (b.cost + cost > budget || (maxitems > 0 && b.nitems == maxitems)) {
+        // Full: run what came before, move this item to the front
+        submit(r, &b, ncmd, b.nitems);
+        memmove(b.strs, item, b.len - start);
+        b.len -= start;
+        b.nitems = 0;
+        b.cost = 0;
+        start = 0;
+      }
+      if (b.nitems == b.itemcap) {
+        b.itemcap = b.itemcap ? b.itemcap * 2 : 1024;
+        b.offs = realloc(b.offs, b.itemcap * sizeof(size_t));
+      }
+      b.offs[b.nitems++] = start;
+      b.cost += cost;
+      start = b.len;
+    }
+    if (n <= 0)
+      break;
+  }
+  submit(r, &b, ncmd, b.nitems);
+
+  free(b.strs);
+  free(b.offs);
+  free(b.argv);
+  return status;
+}
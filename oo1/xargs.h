@@ -0,0 +1,19 @@
+/*
+
+   xargs.h
+
+   Batch items read from a stream into as few command lines as the
+   kernel's argument size limit allows.
+
+ */
+
+#ifndef _XARGS_H
+#define _XARGS_H
+
+#include "runner.h"
+
+#define XARGS_BLANKS -1 /* items separated by any blank or newline */
+
+int xargs(Runner *, int, char **, int, int);
+
+#endif
@@ -0,0 +1,140 @@
+/*
+
+   zcopy.c
+
+   copy_file_range between two regular files, splice when either side
+   is a pipe, sendfile from a regular file to anything else. When the
+   kernel refuses a method for this pair of fds (EINVAL, EXDEV, ...)
+   the next one is tried from where the previous one stopped, ending
+   with a plain read/write loop.
+
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+#include "zcopy.h"
+#include "queue.h"
+
+/* --- symbolic constants --- */
+#define CHUNK   (1 << 20) /* bytes asked for per syscall */
+#define RWCHUNK (1 << 16)
+
+/* --- the kernel can't do this pair: try the next method --- */
+#define refused(e) ((e) == EINVAL || (e) == EXDEV || (e) == ENOSYS || \
+                    (e) == EOPNOTSUPP || (e) == EBADF)
+
+/* --- run one method until EOF; returns bytes moved or -1 --- */
+static ssize_t pump(int method, int from, int to, ssize_t *moved)
+{
+  ssize_t n;
+  char buf[method == ZCOPY_RW ? RWCHUNK : 1];
+
+  for (;;) {
+    switch (method) {
+      case ZCOPY_RANGE:
+        n = copy_file_range(from, NULL, to, NULL, CHUNK, 0);
+        break;
+      case ZCOPY_SPLICE:
+        n = splice(from, NULL, to, NULL, CHUNK, SPLICE_F_MOVE|SPLICE_F_MORE);
+        break;
+      case ZCOPY_SENDFILE:
+        n = sendfile(to, from, NULL, CHUNK);
+        break;
+      default:
+        n = read(from, buf, sizeof(buf));
+        if (n > 0) {
+          ssize_t w, done = 0;
+          while (done < n) {
+            if ((w = write(to, buf + done, n - done)) < 0) {
+              if (errno == EINTR)
+                continue;
+              return -1;
+            }
+            done += w;
+          }
+        }
+        break;
+    }
+    if (n == 0)
+      return 0;
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    *moved += n;
+  }
+}
+
+/* --- through user space, where one side is a queue --- */
+static ssize_t qcopy(int from, int to)
+{
+  char buf[QUEUESIZE];
+  ssize_t moved = 0, n, k, w;
+
+  for (;;) {
+    n = queue_read(from, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return n < 0 ? -1 : moved;
+    for (k = 0; k < n; k += w)
+      if ((w = queue_write(to, buf + k, n - k)) < 0) {
+        if (errno != EINTR)
+          return -1;
+        w = 0;
+      }
+    moved += n;
+  }
+}
+
+/*
+ * zcopy : move data from `from` to `to` until EOF. Returns the number
+ * of bytes moved, or -1 with errno set. If how is not NULL it is set
+ * to the method that finished the transfer.
+ */
+ssize_t zcopy(int from, int to, int *how)
+{
+  struct stat in, out;
+  ssize_t moved = 0;
+  int method;
+
+  if (queue_isfd(from) || queue_isfd(to)) {
+    if (how != NULL)
+      *how = ZCOPY_QUEUE;
+    return qcopy(from, to);
+  }
+  if (fstat(from, &in) < 0 || fstat(to, &out) < 0)
+    return -1;
+
+  if (S_ISREG(in.st_mode) && S_ISREG(out.st_mode) && !(fcntl(to, F_GETFL) & O_APPEND))
+    method = ZCOPY_RANGE;
+  else if (S_ISFIFO(in.st_mode) || S_ISFIFO(out.st_mode))
+    method = ZCOPY_SPLICE;
+  else if (S_ISREG(in.st_mode))
+    method = ZCOPY_SENDFILE;
+  else
+    method = ZCOPY_RW;
+
+  for (;;) {
+    if (pump(method, from, to, &moved) == 0)
+      break;
+    if (!refused(errno) || method == ZCOPY_RW)
+      return -1;
+    // Skip methods that cannot apply to these fd types
+    method++;
+    if (method == ZCOPY_SPLICE && !S_ISFIFO(in.st_mode) && !S_ISFIFO(out.st_mode))
+      method++;
+    if (method == ZCOPY_SENDFILE && !S_ISREG(in.st_mode))
+      method++;
+  }
+  if (how != NULL)
+    *how = method;
+  return moved;
+}
@@ -0,0 +1,24 @@
+/*
+
+   zcopy.h
+
+   Move everything readable from one fd to another without copying it
+   through user space when the kernel allows it.
+
+ */
+
+#ifndef _ZCOPY_H
+#define _ZCOPY_H
+
+#include <sys/types.h>
+
+/* --- how a transfer was done --- */
+#define ZCOPY_RANGE    0 /* copy_file_range: file to file */
+#define ZCOPY_SPLICE   1 /* splice: one side is a pipe */
+#define ZCOPY_SENDFILE 2 /* sendfile: from a file to anything */
+#define ZCOPY_RW       3 /* read/write fallback */
+#define ZCOPY_QUEUE    4 /* one side is an in-memory queue (queue.c) */
+
+ssize_t zcopy(int, int, int *);
+
+#endif
@@ -0,0 +1,344 @@
+/*
+
+   zygote.c
+
+   The fork server. At startup, while the shell is still small, it forks
+   a helper that does nothing but start commands. Each request carries
+   the command's path, argv, environment and redirections; the fds it
+   needs (the shell's cwd, and the pipe ends for stdin/stdout) travel
+   as SCM_RIGHTS. The helper starts the command with
+   clone(CLONE_PARENT), so the command is the shell's child: the shell
+   waits for it, takes its pidfd and reads its rusage exactly as for
+   posix_spawn. However large the shell's heap grows (readline,
+   history, job table), only the small helper is ever copied.
+
+   A stage's CPUs and nice value (affinity.c) ride along in the request
+   header and are applied in the command before it execs.
+
+   The command reports a failed open or exec through a close-on-exec
+   pipe, so the shell hears about it before zygote_spawn returns, as
+   with posix_spawn.
+
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include "zygote.h"
+#include "launch.h"
+#include "affinity.h"
+
+extern char **environ;
+
+/* --- symbolic constants --- */
+#define ZYGOTEFD 3   /* the helper's end of the socket */
+#define ZMAXFDS  3   /* cwd, in, out */
+
+/* --- which optional parts a request has --- */
+#define Z_IN      1  /* stdin fd attached */
+#define Z_OUT     2  /* stdout fd attached */
+#define Z_INFILE  4  /* stdin filename in the payload */
+#define Z_OUTFILE 8  /* stdout filename in the payload */
+#define Z_SCHED   16 /* sched holds CPUs and/or a nice value */
+
+typedef struct _zreq {
+    int flags;
+    int argc, envc;
+    size_t len;      /* payload: path, argv, env, [infile], [outfile] */
+    StageSched sched;
+} ZygoteReq;
+
+typedef struct _zreply {
+    pid_t pid;
+    int err;         /* 0, or the errno of the failed open or exec */
+} ZygoteReply;
+
+static int zsock = -1;  /* the shell's end */
+static pid_t zpid = -1;
+
+/* --- read or write exactly n bytes --- */
+static int readn(int fd, void *buf, size_t n)
+{
+  char *p = buf;
+  while (n > 0) {
+    ssize_t k = read(fd, p, n);
+    if (k < 0 && errno == EINTR)
+      continue;
+    if (k <= 0)
+      return -1;
+    p += k;
+    n -= k;
+  }
+  return 0;
+}
+
+static int writen(int fd, const void *buf, size_t n)
+{
+  const char *p = buf;
+  while (n > 0) {
+    ssize_t k = write(fd, p, n);
+    if (k < 0 && errno == EINTR)
+      continue;
+    if (k < 0)
+      return -1;
+    p += k;
+    n -= k;
+  }
+  return 0;
+}
+
+/* --- in the command: redirect, then exec; only returns an errno --- */
+static int zexec(ZygoteReq *req, char **argv, char **envp, char *infile,
+                 char *outfile, int *fds)
+{
+  int in = -1, out = -1, k = 1;
+
+  signal(SIGINT, SIG_DFL);
+  signal(SIGPIPE, SIG_DFL);
+  if (req->flags & Z_SCHED)
+    affinity_apply(0, &req->sched, argv[0]);
+  if (fchdir(fds[0]) < 0)
+    return errno;
+  if (req->flags & Z_IN)
+    in = fds[k++];
+  if (req->flags & Z_OUT)
+    out = fds[k++];
+  if (infile != NULL && (in = open(infile, O_RDONLY|O_CLOEXEC)) < 0)
+    return errno;
+  if (outfile != NULL && (out = open(outfile, OUTMODE|O_CLOEXEC, OUTPERM)) < 0)
+    return errno;
+  if ((in != -1 && dup2(in, 0) < 0) || (out != -1 && dup2(out, 1) < 0))
+    return errno;
+  execve(argv[-1], argv, envp);
+  return errno;
+}
+
+/* --- in the helper: receive one request, start it, reply --- */
+static int zserve(int sock)
+{
+  ZygoteReq req;
+  ZygoteReply reply = { -1, 0 };
+  char cbuf[CMSG_SPACE(ZMAXFDS * sizeof(int))];
+  struct iovec iov = { &req, sizeof(req) };
+  struct msghdr msg = { 0 };
+  struct cmsghdr *cm;
+  int fds[ZMAXFDS], nfds = 0, report[2], i;
+  ssize_t k;
+
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+  do
+    k = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC|MSG_WAITALL);
+  while (k < 0 && errno == EINTR);
+  if (k != sizeof(req))
+    return -1; // The shell is gone
+  for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm))
+    if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+      nfds = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      memcpy(fds, CMSG_DATA(cm), nfds * sizeof(int));
+    }
+
+  // Payload: path, argv, env, then the filenames, each \0-terminated
+  char *payload = malloc(req.len);
+  char **vec = malloc((req.argc + req.envc + 3) * sizeof(char *));
+  char *p = payload, *infile = NULL, *outfile = NULL;
+  if (payload == NULL || vec == NULL || readn(sock, payload, req.len) < 0)
+    return -1;
+  for (i = 0; i < req.argc + 1; i++, p += strlen(p) + 1)
+    vec[i] = p;
+  vec[i++] = NULL;
+  for (; i < req.argc + req.envc + 2; i++, p += strlen(p) + 1)
+    vec[i] = p;
+  vec[i] = NULL;
+  if (req.flags & Z_INFILE) {
+    infile = p;
+    p += strlen(p) + 1;
+  }
+  if (req.flags & Z_OUTFILE)
+    outfile = p;
+
+  if (nfds < 1)
+    reply.err = EBADF;
+  else if (pipe2(report, O_CLOEXEC) < 0)
+    reply.err = errno;
+  else {
+    // Like fork, but the shell becomes the parent and gets SIGCHLD
+    reply.pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, NULL, NULL, NULL, NULL);
+    if (reply.pid == 0) {
+      close(report[0]);
+      reply.err = zexec(&req, vec + 1, vec + req.argc + 2, infile, outfile, fds);
+      write(report[1], &reply.err, sizeof(int));
+      _exit(127);
+    }
+    if (reply.pid < 0)
+      reply.err = errno;
+    close(report[1]);
+    if (reply.pid > 0 && read(report[0], &reply.err, sizeof(int)) != sizeof(int))
+      reply.err = 0; // EOF: exec went through
+    close(report[0]);
+  }
+
+  for (i = 0; i < nfds; i++)
+    close(fds[i]);
+  free(payload);
+  free(vec);
+  return writen(sock, &reply, sizeof(reply));
+}
+
+/*
+ * zygote_start : fork the helper. Call it early, before the shell has
+ * a large heap. Returns -1 (and the shell keeps posix_spawn) if the
+ * helper could not be started.
+ */
+int zygote_start(void)
+{
+  int sv[2];
+
+  if (socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, sv) < 0)
+    return -1;
+  if ((zpid = fork()) < 0) {
+    close(sv[0]);
+    close(sv[1]);
+    return -1;
+  }
+  if (zpid == 0) { // The helper: keep 0-2 and the socket only
+    signal(SIGINT, SIG_IGN); // ^C is for the commands, not for us
+    signal(SIGPIPE, SIG_DFL);
+    if (dup3(sv[1], ZYGOTEFD, O_CLOEXEC) < 0)
+      _exit(1);
+    close_range(ZYGOTEFD + 1, ~0U, 0);
+    while (zserve(ZYGOTEFD) == 0)
+      ;
+    _exit(0);
+  }
+  close(sv[1]);
+  zsock = sv[0];
+  return 0;
+}
+
+/* --- the helper died or the socket broke: stop using it --- */
+static int zygote_lost(int err)
+{
+  close(zsock);
+  zsock = -1;
+  waitpid(zpid, NULL, WNOHANG);
+  fprintf(stderr, "bosh: fork server lost (%s), using posix_spawn\n", strerror(err));
+  return ENOSYS;
+}
+
+/*
+ * zygote_spawn : have the helper start path with argv, taking stdin/
+ * stdout as spawncmd does and placed as s says (NULL: as the shell).
+ * Returns 0 or an errno value; ENOSYS means there is no helper (any
+ * more) and the caller should spawn itself.
+ */
+int zygote_spawn(pid_t *pid, char *path, char *argv[], int in, int out,
+                 char *infilename, char *outfilename, StageSched *s)
+{
+  ZygoteReq req = { 0 };
+  ZygoteReply reply;
+  char **v;
+  size_t len;
+  int fds[ZMAXFDS], nfds = 0, err;
+
+  if (zsock == -1)
+    return ENOSYS;
+
+  // The helper's cwd is where the shell started: send ours along
+  if ((fds[nfds++] = open(".", O_PATH|O_DIRECTORY|O_CLOEXEC)) < 0)
+    return errno;
+  if (infilename == NULL && in != -1) {
+    req.flags |= Z_IN;
+    fds[nfds++] = in;
+  }
+  if (outfilename == NULL && out != -1) {
+    req.flags |= Z_OUT;
+    fds[nfds++] = out;
+  }
+  if (s != NULL) {
+    req.flags |= Z_SCHED;
+    req.sched = *s;
+  }
+
+  req.len = strlen(path) + 1;
+  for (v = argv; *v != NULL; v++, req.argc++)
+    req.len += strlen(*v) + 1;
+  for (v = environ; *v != NULL; v++, req.envc++)
+    req.len += strlen(*v) + 1;
+  if (infilename != NULL) {
+    req.flags |= Z_INFILE;
+    req.len += strlen(infilename) + 1;
+  }
+  if (outfilename != NULL) {
+    req.flags |= Z_OUTFILE;
+    req.len += strlen(outfilename) + 1;
+  }
+
+  char *payload = malloc(req.len), *p;
+  if (payload == NULL) {
+    close(fds[0]);
+    return ENOMEM;
+  }
+  p = stpcpy(payload, path) + 1;
+  for (v = argv; *v != NULL; v++)
+    p = stpcpy(p, *v) + 1;
+  for (v = environ; *v != NULL; v++)
+    p = stpcpy(p, *v) + 1;
+  if (infilename != NULL)
+    p = stpcpy(p, infilename) + 1;
+  if (outfilename != NULL)
+    p = stpcpy(p, outfilename) + 1;
+
+  // The header carries the fds; the payload follows on the stream
+  char cbuf[CMSG_SPACE(ZMAXFDS * sizeof(int))] = { 0 };
+  struct iovec iov[2] = { { &req, sizeof(req) }, { payload, req.len } };
+  struct msghdr msg = { 0 };
+  struct cmsghdr *cm;
+  ssize_t k;
+
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 2;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+  cm = CMSG_FIRSTHDR(&msg);
+  cm->cmsg_level = SOL_SOCKET;
+  cm->cmsg_type = SCM_RIGHTS;
+  cm->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+  memcpy(CMSG_DATA(cm), fds, nfds * sizeof(int));
+
+  do
+    k = sendmsg(zsock, &msg, MSG_NOSIGNAL);
+  while (k < 0 && errno == EINTR);
+  err = k < (ssize_t) sizeof(req) ? (k < 0 ? errno : EPIPE) : 0;
+  close(fds[0]);
+  len = sizeof(req) + req.len;
+  if (err == 0 && (size_t) k < len && // The rest of a long environment
+      writen(zsock, payload + (k - sizeof(req)), len - k) < 0)
+    err = errno;
+  free(payload);
+  if (err != 0)
+    return zygote_lost(err);
+
+  if (readn(zsock, &reply, sizeof(reply)) < 0)
+    return zygote_lost(EPIPE);
+  if (reply.err != 0) {
+    if (reply.pid > 0) // Our child now: collect it
+      waitpid(reply.pid, NULL, 0);
+    return reply.err;
+  }
+  *pid = reply.pid;
+  return 0;
+}
@@ -0,0 +1,21 @@
+/*
+
+   zygote.h
+
+   Fork server: a small helper process, forked at startup, that starts
+   commands on behalf of the shell.
+
+ */
+
+#ifndef _ZYGOTE_H
+#define _ZYGOTE_H
+
+#include <sys/types.h>
+
+struct _stagesched;
+
+int zygote_start(void);
+int zygote_spawn(pid_t *, char *, char *[], int, int, char *, char *,
+                 struct _stagesched *);
+
+#endif